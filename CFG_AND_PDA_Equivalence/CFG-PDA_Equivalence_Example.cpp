@@ -1,19 +1,177 @@
 #include <iostream>
 #include <string>
-#include <stack>
 #include <limits>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cerrno>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+#include "../Common/GrammarReader.h"
+
+// Run scanning uses SSE2 where the target has it (every x86-64 target);
+// build with -DPDA_NO_SIMD for the scalar loop alone.
+#if !defined(PDA_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PDA_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+
+// A stack stored as runs of equal symbols, (symbol, count) pairs, so n
+// copies of one symbol take one pair however large n gets. PDAs whose
+// stacks are mostly long runs (a unary stack alphabet, or counting
+// phases like the $ run in simulatePDA) use constant or near-constant
+// memory, and a push or pop is an increment or decrement of the top count.
+class RunLengthStack {
+private:
+    struct Run {
+        unsigned char symbol;
+        uint64_t count;
+    };
+    std::vector<Run> runs;
+    uint64_t total = 0;
+
+public:
+    bool empty() const { return total == 0; }
+    uint64_t size() const { return total; }
+    unsigned char top() const { return runs.back().symbol; }
+
+    void push(unsigned char symbol, uint64_t count = 1) {
+        if (!count) return;
+        if (!runs.empty() && runs.back().symbol == symbol) {
+            runs.back().count += count;
+        } else {
+            runs.push_back(Run{symbol, count});
+        }
+        total += count;
+    }
+
+    void pop() {
+        total--;
+        if (--runs.back().count == 0) runs.pop_back();
+    }
+
+    // Pops count symbols, which may span runs; count <= size().
+    void pop(uint64_t count) {
+        total -= count;
+        while (count) {
+            uint64_t taken = std::min(count, runs.back().count);
+            count -= taken;
+            if ((runs.back().count -= taken) == 0) runs.pop_back();
+        }
+    }
+
+    uint64_t topCount() const { return runs.back().count; }
+
+    void clear() {
+        runs.clear();
+        total = 0;
+    }
+
+    // Calls f(symbol, count) for each run, bottom first.
+    template <typename F>
+    void forEachRun(F f) const {
+        for (const Run& run : runs) f(run.symbol, run.count);
+    }
+
+    size_t runCount() const { return runs.size(); }
+    size_t memory() const { return runs.capacity() * sizeof(Run); }
+    static size_t bytesPerRun() { return sizeof(Run); }
+};
+
+// ==========================================
+// Run Scanning
+// ==========================================
+
+#ifdef PDA_SSE2
+inline unsigned lowestSetBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+inline unsigned highestSetBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return 31u - static_cast<unsigned>(__builtin_clz(mask));
+#endif
+}
+#endif
+
+// Length of the run of c at the start of p[0, n). With SSE2, 16 bytes are
+// compared at once and the first mismatch is the lowest clear bit of the
+// compare mask; the scalar loop finishes the tail.
+inline size_t runLength(const char* p, size_t n, char c) {
+    size_t i = 0;
+#ifdef PDA_SSE2
+    const __m128i wanted = _mm_set1_epi8(c);
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        unsigned differ = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, wanted))) ^ 0xFFFFu;
+        if (differ) return i + lowestSetBit(differ);
+    }
+#endif
+    while (i < n && p[i] == c) i++;
+    return i;
+}
+
+// Length of the run of c that ends at end[-1], looking back at most n bytes.
+inline size_t runLengthBackward(const unsigned char* end, size_t n, unsigned char c) {
+    size_t i = 0;
+#ifdef PDA_SSE2
+    const __m128i wanted = _mm_set1_epi8(static_cast<char>(c));
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(end - i - 16));
+        unsigned differ = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, wanted))) ^ 0xFFFFu;
+        if (differ) return i + 15 - highestSetBit(differ);
+    }
+#endif
+    while (i < n && end[-1 - static_cast<ptrdiff_t>(i)] == c) i++;
+    return i;
+}
+
+// Each run of equal input characters is handled at once: a run of 'a's
+// in q_start is that many pushes of '$', and a run of 'b's that many pops.
 bool simulatePDA(const std::string& input) {
-    std::stack<char> pdaStack;
+    RunLengthStack pdaStack;
     enum State { q_start, q_read_b };
     State currentState = q_start;
 
-    for (char c : input) {
+    for (size_t i = 0; i < input.length(); i++) {
+        char c = input[i];
         switch (currentState) {
             case q_start:
                 if (c == 'a') {
-                    pdaStack.push('$');
+                    size_t run = runLength(input.data() + i, input.length() - i, 'a');
+                    pdaStack.push('$', run);
+                    i += run - 1;
                 } else if (c == 'b') {
                     currentState = q_read_b;
                     if (pdaStack.empty()) return false;
@@ -24,8 +182,10 @@ bool simulatePDA(const std::string& input) {
                 break;
             case q_read_b:
                 if (c == 'b') {
-                    if (pdaStack.empty()) return false;
-                    pdaStack.pop();
+                    size_t run = runLength(input.data() + i, input.length() - i, 'b');
+                    if (run > pdaStack.size()) return false; // Pops past the bottom
+                    pdaStack.pop(run);
+                    i += run - 1;
                 } else {
                     return false; // 'a' after 'b'
                 }
@@ -60,15 +220,1984 @@ bool parseS(const std::string& input, size_t& index) {
     return true;
 }
 
+// parseS without recursion. parseS descends one level per leading 'a'
+// and each level then needs one 'b' on the way back up, so a count of
+// open levels replaces the call stack: same result and same final index
+// as parseS on every input, in constant stack space however deep the
+// input nests.
+bool parseSIterative(const std::string& input, size_t& index) {
+    size_t open = 0;
+    while (index < input.length() && input[index] == 'a') {
+        index++;
+        open++;
+    }
+    for (; open > 0; open--) {
+        if (index < input.length() && input[index] == 'b') {
+            index++;
+        } else {
+            return false; // 'a' was not followed by 'b'
+        }
+    }
+    return true;
+}
+
 bool parseCFG(const std::string& input) {
     size_t currentIndex = 0;
-    bool success = parseS(input, currentIndex);
+    bool success = parseSIterative(input, currentIndex);
 
     return success && (currentIndex == input.length());
 }
 
 
-int main() {
+// ==========================================
+// Table-Driven DPDA Engine
+// ==========================================
+
+// PDA definitions, one directive or transition per line:
+//
+//     start q_start            # initial state
+//     bottom Z                 # initial stack symbol (optional: stack starts empty)
+//     accept q_done ...        # accept by final state, after the input and any epsilon moves
+//     accept-empty             # accept by empty stack (either kind of acceptance suffices)
+//     q_start a - -> q_start $ # delta(q_start, a, empty stack) = (q_start, $)
+//     q_start a $ -> q_start $$
+//     q_start b $ -> q_read_b eps
+//
+// A transition is "state input top -> state push": input is one character
+// or eps, top is one stack character or '-' for the empty stack (matches
+// only when the stack is empty, and is not popped), and push is the string
+// that replaces the top, leftmost character on top, or eps. '#' starts a
+// comment. Stack and input symbols are single bytes.
+const char* const SIMULATE_PDA_DEFINITION =
+    "# simulatePDA as a table: L = { a^n b^n }, accepted by empty stack\n"
+    "start q_start\n"
+    "accept-empty\n"
+    "q_start  a -  -> q_start  $\n"
+    "q_start  a $  -> q_start  $$\n"
+    "q_start  b $  -> q_read_b eps\n"
+    "q_read_b b $  -> q_read_b eps\n";
+
+// A parsed definition in the format above, shared by the deterministic
+// engine and the nondeterministic simulator. Input and stack characters are
+// numbered into dense classes; class 0 is "not in the input alphabet" and,
+// for stack tops, the empty stack.
+struct PDADefinition {
+    struct Rule {
+        uint32_t from;
+        int input;   // -1: eps
+        int top;     // -1: '-' (empty stack, not popped)
+        uint32_t to;
+        std::string push;
+        size_t line;
+    };
+
+    std::string source;
+    std::vector<std::string> stateNames;
+    std::vector<Rule> rules;
+    std::vector<char> accepting;
+    uint32_t startState = 0;
+    std::string bottom;
+    bool acceptEmpty = false;
+    uint16_t inputClass[256];
+    uint16_t topClass[256];
+    size_t inputClasses = 1;
+    size_t topClasses = 1;
+
+    bool error(size_t line, const std::string& message) const {
+        std::cerr << "Error: " << source << ":" << line << ": " << message << std::endl;
+        return false;
+    }
+
+    // 'name' identifies the definition in diagnostics.
+    bool parse(std::istream& in, const std::string& name) {
+        std::map<std::string, uint32_t> stateIds;
+        std::vector<std::string> acceptNames;
+        std::string startName;
+        auto stateId = [&](const std::string& state) {
+            auto found = stateIds.find(state);
+            if (found != stateIds.end()) return found->second;
+            uint32_t id = static_cast<uint32_t>(stateNames.size());
+            stateIds[state] = id;
+            stateNames.push_back(state);
+            return id;
+        };
+
+        source = name;
+        stateNames.clear();
+        rules.clear();
+        bottom.clear();
+        acceptEmpty = false;
+        std::string text;
+        for (size_t line = 1; std::getline(in, text); line++) {
+            size_t hash = text.find('#');
+            if (hash != std::string::npos) text.erase(hash);
+            std::istringstream words(text);
+            std::vector<std::string> w;
+            for (std::string word; words >> word;) w.push_back(word);
+            if (w.empty()) continue;
+
+            if (w[0] == "start" && w.size() == 2) {
+                startName = w[1];
+            } else if (w[0] == "bottom" && w.size() == 2 && w[1].size() == 1 && w[1][0] != '\0') {
+                bottom = w[1];
+            } else if (w[0] == "accept" && w.size() >= 2) {
+                acceptNames.insert(acceptNames.end(), w.begin() + 1, w.end());
+            } else if (w[0] == "accept-empty" && w.size() == 1) {
+                acceptEmpty = true;
+            } else if (w.size() == 6 && w[3] == "->") {
+                Rule r;
+                r.from = stateId(w[0]);
+                r.to = stateId(w[4]);
+                r.line = line;
+                if (w[1] == "eps") {
+                    r.input = -1;
+                } else if (w[1].size() == 1) {
+                    r.input = static_cast<unsigned char>(w[1][0]);
+                } else {
+                    return error(line, "input must be one character or eps");
+                }
+                if (w[2] == "-") {
+                    r.top = -1;
+                } else if (w[2].size() == 1) {
+                    r.top = static_cast<unsigned char>(w[2][0]);
+                } else {
+                    return error(line, "stack top must be one character or -");
+                }
+                r.push = w[5] == "eps" ? std::string() : w[5];
+                if (r.push.size() > 255) return error(line, "push string longer than 255");
+                if (r.top == 0 || r.push.find('\0') != std::string::npos) return error(line, "NUL can't be a stack symbol");
+                rules.push_back(r);
+            } else {
+                return error(line, "expected a directive or 'state input top -> state push'");
+            }
+        }
+        if (startName.empty()) return error(0, "no start state");
+        startState = stateId(startName);
+        for (const std::string& state : acceptNames) {
+            if (!stateIds.count(state)) return error(0, "accepting state " + state + " has no transitions");
+        }
+        accepting.assign(stateNames.size(), 0);
+        for (const std::string& state : acceptNames) accepting[stateIds[state]] = 1;
+        classify();
+        return true;
+    }
+
+    // Numbers the input and stack characters used by the rules.
+    void classify() {
+        std::memset(inputClass, 0, sizeof(inputClass));
+        std::memset(topClass, 0, sizeof(topClass));
+        inputClasses = 1;
+        topClasses = 1;
+        auto addTop = [&](unsigned char c) { if (!topClass[c]) topClass[c] = static_cast<uint16_t>(topClasses++); };
+        for (const Rule& r : rules) {
+            if (r.input >= 0 && !inputClass[r.input]) inputClass[r.input] = static_cast<uint16_t>(inputClasses++);
+            if (r.top >= 0) addTop(static_cast<unsigned char>(r.top));
+            for (char c : r.push) addTop(static_cast<unsigned char>(c));
+        }
+        for (char c : bottom) addTop(static_cast<unsigned char>(c));
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            std::cerr << "Error: cannot open " << path << std::endl;
+            return false;
+        }
+        return parse(in, path);
+    }
+
+    // Writes the definition back in the text format.
+    void write(std::ostream& out) const {
+        out << "start " << stateNames[startState] << "\n";
+        if (!bottom.empty()) out << "bottom " << bottom << "\n";
+        for (size_t q = 0; q < stateNames.size(); q++) {
+            if (accepting[q]) out << "accept " << stateNames[q] << "\n";
+        }
+        if (acceptEmpty) out << "accept-empty\n";
+        for (const Rule& r : rules) {
+            out << stateNames[r.from] << " ";
+            if (r.input < 0) out << "eps"; else out << static_cast<char>(r.input);
+            out << " ";
+            if (r.top < 0) out << "-"; else out << static_cast<char>(r.top);
+            out << " -> " << stateNames[r.to] << " " << (r.push.empty() ? std::string("eps") : r.push) << "\n";
+        }
+    }
+};
+
+// Where one run of a DPDA is: the current state, the stack and whether it
+// has already rejected. The stack is kept one of three ways (see
+// DPDA::StackMode): contiguous bytes, top at stack[height - 1] (the vector
+// only grows while it is in use); just the height, when only one symbol
+// can be on the stack; or runs of equal symbols.
+struct DPDARun {
+    uint32_t state = 0;
+    std::vector<unsigned char> stack;
+    RunLengthStack runs;
+    size_t height = 0;
+    bool asRuns = false;   // Auto mode: the stack is in 'runs' for now
+    size_t nextCheck = 0;  // Auto mode: bytes-stack height of the next run count
+    bool dead = false;
+    size_t steps = 0;     // Moves made, epsilon moves included
+    size_t consumed = 0;  // Input bytes read
+};
+
+// Runs any deterministic PDA from a definition. Transitions are compiled
+// into one dense jump table indexed by (state, input class, stack-top
+// class), so a step is one table load, a pop and a copy of the pushed
+// bytes. Row offsets are premultiplied: an action stores the table offset
+// of its target state, and inputOffset[c] is c's class times the number
+// of stack-top classes. Epsilon moves have their own (state, top) table
+// and cost nothing for machines without them.
+//
+// A machine with a single stack symbol keeps only the stack height, so
+// its memory is constant and a step touches no stack memory at all. Any
+// other machine starts each run with a byte stack and moves it to runs of
+// equal symbols while the runs are long (StackMode::Auto).
+class DPDA {
+public:
+    enum class StackMode { Bytes, Counter, Runs, Auto };
+
+private:
+    struct Action {
+        uint32_t next;   // Table offset of the target state; NONE: no move
+        uint32_t push;   // Up to 4 bytes: the bytes; longer: offset into 'pushes'. Bottom-first
+        uint8_t length;  // Bytes pushed
+        uint8_t pop;     // 0 for the empty-stack pseudo symbol
+        uint8_t top;     // Stack-top class after a push (length > 0); NUL is never stacked, so classes fit
+        uint8_t repeat;  // REPEAT_*: what a run of the same input character does
+    };
+    static const uint32_t NONE = 0xFFFFFFFFu;
+    static const uint16_t EMPTY_TOP = 0; // Stack-top class of the empty stack
+    static const size_t AUTO_SLICE = 1 << 16;      // Auto mode: input bytes between layout checks
+    static const size_t AUTO_MIN_HEIGHT = 1 << 20; // Auto mode: smaller stacks stay bytes
+
+    // A self-loop whose stack top is the same after the move can take a
+    // whole run of its input character at once: SKIP leaves the stack
+    // alone, GROW pops X and pushes X^m (a net m - 1 X's per character) and
+    // POP pops X, for as long as the stack shows X's. The determinism check
+    // guarantees no epsilon move competes for the same state and top.
+    enum : uint8_t { REPEAT_NONE, REPEAT_SKIP, REPEAT_GROW, REPEAT_POP };
+
+    std::vector<std::string> stateNames;
+    std::vector<char> accepting;
+    bool acceptEmpty = false;
+    bool hasEpsilon = false;
+    uint32_t startState = 0;
+    std::string bottom;
+    uint32_t inputOffset[256]; // 0: not in the input alphabet (a row of NONE)
+    uint16_t topClass[256];    // 0: never on the stack
+    size_t inputClasses = 1;
+    size_t topClasses = 1;
+    size_t stateStride = 1;       // inputClasses * topClasses
+    std::vector<Action> table;    // [state * stateStride + inputOffset[c] + top]
+    std::vector<Action> epsilon;  // [state * topClasses + top]
+    std::string pushes;
+    StackMode mode = StackMode::Bytes;
+    uint16_t unaryTop = EMPTY_TOP; // The one stack-top class, in Counter mode
+
+    // How this run's stack is kept: the mode, or in Auto mode its current layout.
+    StackMode layout(const DPDARun& run) const {
+        if (mode != StackMode::Auto) return mode;
+        return run.asRuns ? StackMode::Runs : StackMode::Bytes;
+    }
+
+    uint16_t topOf(const DPDARun& run) const {
+        if (!run.height) return EMPTY_TOP;
+        switch (layout(run)) {
+            case StackMode::Counter: return unaryTop;
+            case StackMode::Runs: return topClass[run.runs.top()];
+            default: return topClass[run.stack[run.height - 1]];
+        }
+    }
+
+    const char* bytesOf(const Action& a) const {
+        return a.length <= 4 ? reinterpret_cast<const char*>(&a.push) : pushes.data() + a.push;
+    }
+
+    void apply(DPDARun& run, const Action& a) const {
+        run.height -= a.pop;
+        const StackMode kept = layout(run);
+        if (kept == StackMode::Bytes) {
+            if (run.height + a.length > run.stack.size()) run.stack.resize(2 * (run.height + a.length));
+            std::memcpy(&run.stack[run.height], bytesOf(a), a.length);
+        } else if (kept == StackMode::Runs) {
+            if (a.pop) run.runs.pop();
+            const char* bytes = bytesOf(a);
+            for (uint8_t k = 0; k < a.length; k++) run.runs.push(static_cast<unsigned char>(bytes[k]));
+        }
+        run.height += a.length;
+        run.state = a.next / stateStride;
+        run.steps++;
+    }
+
+    // Follows epsilon moves. A run longer than the stack height plus the
+    // number of (state, top) pairs has revisited a pair without shrinking
+    // the stack, so the machine is looping.
+    bool closeEpsilon(DPDARun& run) const {
+        size_t limit = run.height + stateNames.size() * topClasses + 1;
+        for (size_t n = 0;; n++) {
+            const Action& a = epsilon[run.state * topClasses + topOf(run)];
+            if (a.next == NONE) return true;
+            if (n == limit) {
+                std::cerr << "Error: epsilon loop in state " << stateNames[run.state] << std::endl;
+                return false;
+            }
+            apply(run, a);
+        }
+    }
+
+public:
+    DPDA() {
+        std::memset(inputOffset, 0, sizeof(inputOffset));
+        std::memset(topClass, 0, sizeof(topClass));
+    }
+
+    // Compiles a parsed definition, rejecting anything nondeterministic:
+    // two moves for one (state, input, top), or an epsilon move next to an
+    // input move for the same (state, top).
+    bool compile(const PDADefinition& def) {
+        stateNames = def.stateNames;
+        accepting = def.accepting;
+        acceptEmpty = def.acceptEmpty;
+        startState = def.startState;
+        bottom = def.bottom;
+        inputClasses = def.inputClasses;
+        topClasses = def.topClasses;
+        std::memcpy(topClass, def.topClass, sizeof(topClass));
+        stateStride = inputClasses * topClasses;
+        for (int c = 0; c < 256; c++) inputOffset[c] = static_cast<uint32_t>(def.inputClass[c] * topClasses);
+
+        const size_t states = stateNames.size();
+        table.assign(states * stateStride, Action{NONE, 0, 0, 0, 0, REPEAT_NONE});
+        epsilon.assign(states * topClasses, Action{NONE, 0, 0, 0, 0, REPEAT_NONE});
+        pushes.clear();
+        hasEpsilon = false;
+
+        for (const PDADefinition::Rule& r : def.rules) {
+            uint16_t top = r.top < 0 ? EMPTY_TOP : topClass[r.top];
+            Action& slot = r.input < 0 ? epsilon[r.from * topClasses + top]
+                                       : table[r.from * stateStride + inputOffset[r.input] + top];
+            if (slot.next != NONE) return def.error(r.line, "second move for the same state, input and top");
+            slot.next = static_cast<uint32_t>(r.to * stateStride);
+            slot.length = static_cast<uint8_t>(r.push.size());
+            std::string bytes(r.push.rbegin(), r.push.rend());
+            if (bytes.size() <= 4) {
+                slot.push = 0;
+                std::memcpy(&slot.push, bytes.data(), bytes.size());
+            } else {
+                slot.push = static_cast<uint32_t>(pushes.size());
+                pushes += bytes;
+            }
+            slot.pop = r.top >= 0;
+            slot.top = static_cast<uint8_t>(r.push.empty() ? EMPTY_TOP : topClass[static_cast<unsigned char>(r.push[0])]);
+            slot.repeat = REPEAT_NONE;
+            if (r.input >= 0 && r.to == r.from) {
+                if (r.top < 0 && r.push.empty()) {
+                    slot.repeat = REPEAT_SKIP;
+                } else if (r.top >= 0 && r.push.empty()) {
+                    slot.repeat = REPEAT_POP;
+                } else if (r.top >= 0 && r.push.find_first_not_of(static_cast<char>(r.top)) == std::string::npos) {
+                    slot.repeat = REPEAT_GROW;
+                }
+            }
+            hasEpsilon = hasEpsilon || r.input < 0;
+        }
+        mode = topClasses == 2 ? StackMode::Counter : StackMode::Auto;
+        unaryTop = topClasses == 2 ? 1 : EMPTY_TOP;
+        for (size_t q = 0; q < states; q++) {
+            for (size_t top = 0; top < topClasses; top++) {
+                if (epsilon[q * topClasses + top].next == NONE) continue;
+                for (size_t in = 1; in < inputClasses; in++) {
+                    if (table[q * stateStride + in * topClasses + top].next != NONE) {
+                        return def.error(0, "state " + stateNames[q] + " has both an epsilon move and an input move for one stack top");
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // 'source' names the definition in diagnostics.
+    bool parse(std::istream& in, const std::string& source) {
+        PDADefinition def;
+        return def.parse(in, source) && compile(def);
+    }
+
+    bool load(const std::string& path) {
+        PDADefinition def;
+        return def.load(path) && compile(def);
+    }
+
+    // compile() chooses Counter for single-symbol stacks and Auto for the
+    // rest. Bytes or Runs fixes one layout for every run; no mode can be
+    // left for Counter on a machine with more than one stack symbol.
+    bool setStackMode(StackMode wanted) {
+        if (wanted == StackMode::Counter && topClasses != 2) return false;
+        mode = wanted;
+        return true;
+    }
+
+    StackMode stackMode() const { return mode; }
+
+    static const char* modeName(StackMode m) {
+        return m == StackMode::Counter ? "counter" : m == StackMode::Runs ? "runs" : m == StackMode::Auto ? "auto" : "bytes";
+    }
+
+    // Heap bytes held by a run's stack.
+    size_t stackBytes(const DPDARun& run) const {
+        const StackMode kept = layout(run);
+        return kept == StackMode::Bytes ? run.stack.capacity() : kept == StackMode::Runs ? run.runs.memory() : 0;
+    }
+
+    void start(DPDARun& run) const {
+        run.state = startState;
+        run.stack.clear();
+        run.runs.clear();
+        run.asRuns = mode == StackMode::Runs;
+        run.nextCheck = 0;
+        if (layout(run) == StackMode::Bytes) {
+            run.stack.assign(bottom.begin(), bottom.end());
+            run.stack.resize(std::max<size_t>(run.stack.size(), 64));
+        } else if (run.asRuns) {
+            for (char c : bottom) run.runs.push(static_cast<unsigned char>(c));
+        }
+        run.height = bottom.size();
+        run.dead = false;
+        run.steps = 0;
+        run.consumed = 0;
+    }
+
+    // Consumes n more input bytes; false once the run has rejected. In
+    // Auto mode the input goes in slices, and the stack layout is checked
+    // after each one.
+    bool feed(DPDARun& run, const char* input, size_t n) const {
+        if (run.dead) return false;
+        size_t consumed = 0;
+        switch (mode) {
+            case StackMode::Counter: consumed = feedCounter(run, input, n); break;
+            case StackMode::Runs: consumed = feedRuns(run, input, n); break;
+            case StackMode::Bytes: consumed = feedBytes(run, input, n); break;
+            case StackMode::Auto:
+                while (consumed < n) {
+                    size_t slice = std::min(n - consumed, AUTO_SLICE);
+                    size_t done = run.asRuns ? feedRuns(run, input + consumed, slice) : feedBytes(run, input + consumed, slice);
+                    consumed += done;
+                    if (done < slice) break;
+                    relayout(run);
+                }
+                break;
+        }
+        run.consumed += consumed;
+        if (consumed < n) run.dead = true;
+        return !run.dead;
+    }
+
+private:
+    // Auto mode: moves a byte stack of at least AUTO_MIN_HEIGHT symbols to
+    // runs once they would take a quarter of its bytes or less, and a runs
+    // stack back to bytes once the runs take more memory than the bytes
+    // would. A byte stack is only counted again after its height doubles,
+    // and the count stops at the limit, so the checks cost O(1) per
+    // stacked symbol.
+    void relayout(DPDARun& run) const {
+        const size_t height = run.height;
+        if (!run.asRuns) {
+            if (height < std::max(AUTO_MIN_HEIGHT, run.nextCheck)) return;
+            run.nextCheck = 2 * height;
+            const char* stack = reinterpret_cast<const char*>(run.stack.data());
+            const size_t limit = height / (4 * RunLengthStack::bytesPerRun());
+            size_t count = 0;
+            for (size_t at = 0; at < height && count <= limit; count++) at += runLength(stack + at, height - at, stack[at]);
+            if (count > limit) return;
+            run.runs.clear();
+            for (size_t at = 0; at < height;) {
+                size_t k = runLength(stack + at, height - at, stack[at]);
+                run.runs.push(static_cast<unsigned char>(stack[at]), k);
+                at += k;
+            }
+            std::vector<unsigned char>().swap(run.stack);
+            run.asRuns = true;
+        } else if (run.runs.runCount() * RunLengthStack::bytesPerRun() > height) {
+            run.stack.assign(std::max<size_t>(2 * height, 64), 0);
+            size_t at = 0;
+            run.runs.forEachRun([&](unsigned char symbol, uint64_t count) {
+                std::memset(&run.stack[at], symbol, static_cast<size_t>(count));
+                at += static_cast<size_t>(count);
+            });
+            run.runs = RunLengthStack();
+            run.nextCheck = 2 * height;
+            run.asRuns = false;
+        }
+    }
+
+    // The feed loops return how much input they consumed. Each keeps what
+    // it reads in locals and only leaves them for epsilon moves: stack
+    // writes go through unsigned char*, which may alias any member, so
+    // members read in the loop would be reloaded every step.
+    //
+    // runEnd is the end of the last input run scanned. A run cut short by
+    // the stack is picked up again from there, not scanned again, so a
+    // long input run met by many short stack runs stays linear.
+    size_t feedBytes(DPDARun& run, const char* input, size_t n) const {
+        const Action* moves = table.data();
+        const uint32_t* offsetOf = inputOffset;
+        const uint16_t* classOf = topClass;
+        const char* pushed = pushes.data();
+        const bool epsilonMoves = hasEpsilon;
+        // Row of the current state plus the stack-top class: one add from
+        // the next action, and the state is cursor / stateStride.
+        uint32_t cursor = static_cast<uint32_t>(run.state * stateStride + topOf(run));
+        unsigned char* stack = run.stack.data();
+        size_t height = run.height;
+        size_t capacity = run.stack.size();
+        size_t i = 0, runEnd = 0;
+        for (; i < n; i++) {
+            if (epsilonMoves) {
+                run.state = cursor / stateStride;
+                run.height = height;
+                if (!closeEpsilon(run)) break;
+                cursor = static_cast<uint32_t>(run.state * stateStride + topOf(run));
+                stack = run.stack.data();
+                height = run.height;
+                capacity = run.stack.size();
+            }
+            const Action a = moves[cursor + offsetOf[static_cast<unsigned char>(input[i])]];
+            if (a.next == NONE) break;
+            if (a.repeat != REPEAT_NONE) {
+                if (i >= runEnd) runEnd = i + runLength(input + i, n - i, input[i]);
+                size_t k = runEnd - i;
+                if (a.repeat == REPEAT_GROW) {
+                    size_t grow = k * (a.length - 1);
+                    if (height + 4 + grow > capacity) {
+                        run.stack.resize(2 * (height + 4 + grow));
+                        stack = run.stack.data();
+                        capacity = run.stack.size();
+                    }
+                    std::memset(stack + height, stack[height - 1], grow);
+                    height += grow;
+                } else if (a.repeat == REPEAT_POP) {
+                    // Only as far back as the input run could pop.
+                    k = runLengthBackward(stack + height, std::min(k, height), stack[height - 1]);
+                    height -= k;
+                    cursor = a.next + (height ? classOf[stack[height - 1]] : EMPTY_TOP);
+                }
+                i += k - 1;
+                continue;
+            }
+            height -= a.pop;
+            if (height + 4 + a.length > capacity) {
+                run.stack.resize(2 * (height + 4 + a.length));
+                stack = run.stack.data();
+                capacity = run.stack.size();
+            }
+            // Short pushes are one 4-byte store; bytes past the new top are garbage.
+            if (a.length <= 4) {
+                std::memcpy(stack + height, &a.push, 4);
+            } else {
+                std::memcpy(stack + height, pushed + a.push, a.length);
+            }
+            height += a.length;
+            // The new top is known after a push; only a pure pop reads the stack.
+            cursor = a.next + (a.length ? a.top : height ? classOf[stack[height - 1]] : EMPTY_TOP);
+        }
+        run.state = cursor / stateStride;
+        run.height = height;
+        run.steps += i;
+        return i;
+    }
+
+    // Only one symbol can be on the stack, so the height is the stack.
+    size_t feedCounter(DPDARun& run, const char* input, size_t n) const {
+        const Action* moves = table.data();
+        const uint32_t* offsetOf = inputOffset;
+        const uint16_t unary = unaryTop;
+        uint32_t row = static_cast<uint32_t>(run.state * stateStride);
+        size_t height = run.height;
+        size_t i = 0, runEnd = 0;
+        for (; i < n; i++) {
+            if (hasEpsilon) {
+                run.state = row / stateStride;
+                run.height = height;
+                if (!closeEpsilon(run)) break;
+                row = static_cast<uint32_t>(run.state * stateStride);
+                height = run.height;
+            }
+            const Action& a = moves[row + offsetOf[static_cast<unsigned char>(input[i])] + (height ? unary : EMPTY_TOP)];
+            if (a.next == NONE) break;
+            if (a.repeat != REPEAT_NONE) {
+                if (i >= runEnd) runEnd = i + runLength(input + i, n - i, input[i]);
+                size_t k = runEnd - i;
+                if (a.repeat == REPEAT_POP) k = std::min(k, height);
+                height = height - k * a.pop + k * a.length;
+                i += k - 1;
+                continue;
+            }
+            height = height - a.pop + a.length;
+            row = a.next;
+        }
+        run.state = row / stateStride;
+        run.height = height;
+        run.steps += i;
+        return i;
+    }
+
+    size_t feedRuns(DPDARun& run, const char* input, size_t n) const {
+        size_t i = 0, runEnd = 0;
+        for (; i < n; i++) {
+            if (hasEpsilon && !closeEpsilon(run)) break;
+            const Action& a = table[run.state * stateStride + inputOffset[static_cast<unsigned char>(input[i])] + topOf(run)];
+            if (a.next == NONE) break;
+            if (a.repeat != REPEAT_NONE) {
+                if (i >= runEnd) runEnd = i + runLength(input + i, n - i, input[i]);
+                size_t k = runEnd - i;
+                if (a.repeat == REPEAT_GROW) {
+                    run.runs.push(run.runs.top(), k * (a.length - 1));
+                    run.height += k * (a.length - 1);
+                } else if (a.repeat == REPEAT_POP) {
+                    k = static_cast<size_t>(std::min<uint64_t>(k, run.runs.topCount()));
+                    run.runs.pop(k);
+                    run.height -= k;
+                }
+                run.steps += k;
+                i += k - 1;
+                continue;
+            }
+            apply(run, a);
+        }
+        return i;
+    }
+
+public:
+    // End of input: accepts if a final state (or the empty stack, with
+    // accept-empty) is reached along the remaining epsilon moves.
+    bool finish(DPDARun& run) const {
+        if (run.dead) return false;
+        size_t limit = run.height + stateNames.size() * topClasses + 1;
+        for (size_t n = 0;; n++) {
+            if (accepting[run.state] || (acceptEmpty && run.height == 0)) return true;
+            const Action& a = epsilon[run.state * topClasses + topOf(run)];
+            if (a.next == NONE || n == limit) return false;
+            apply(run, a);
+        }
+    }
+
+    bool accepts(const std::string& input, DPDARun& run) const {
+        start(run);
+        return feed(run, input.data(), input.size()) && finish(run);
+    }
+
+    bool accepts(const std::string& input) const {
+        DPDARun run;
+        return accepts(input, run);
+    }
+
+    size_t states() const { return stateNames.size(); }
+};
+
+const size_t DPDA::AUTO_SLICE;
+const size_t DPDA::AUTO_MIN_HEIGHT;
+
+// ==========================================
+// Nondeterministic PDA Simulation
+// ==========================================
+
+// Even-length palindromes over {a, b}: push the first half, guess the
+// middle, pop the second half. Every position is a possible middle.
+const char* const EVEN_PALINDROME_DEFINITION =
+    "start q_push\n"
+    "bottom Z\n"
+    "accept q_done\n"
+    "q_push a Z -> q_push aZ\n"
+    "q_push a a -> q_push aa\n"
+    "q_push a b -> q_push ab\n"
+    "q_push b Z -> q_push bZ\n"
+    "q_push b a -> q_push ba\n"
+    "q_push b b -> q_push bb\n"
+    "q_push eps Z -> q_pop Z\n"
+    "q_push eps a -> q_pop a\n"
+    "q_push eps b -> q_pop b\n"
+    "q_pop  a a -> q_pop eps\n"
+    "q_pop  b b -> q_pop eps\n"
+    "q_pop  eps Z -> q_done eps\n";
+
+// Set of 64-bit keys that is emptied in O(1) by bumping a stamp, so it can
+// be cleared once per input position.
+class StampedSet {
+private:
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> stamps;
+    uint32_t stamp = 1;
+    size_t count = 0;
+
+    static size_t slotOf(uint64_t key, size_t mask) {
+        key *= 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(key >> 32) & mask;
+    }
+
+    void grow() {
+        std::vector<uint64_t> oldKeys(keys.size() * 2);
+        std::vector<uint32_t> oldStamps(stamps.size() * 2, 0);
+        oldKeys.swap(keys);
+        oldStamps.swap(stamps);
+        const size_t mask = keys.size() - 1;
+        for (size_t i = 0; i < oldKeys.size(); i++) {
+            if (oldStamps[i] != stamp) continue;
+            size_t slot = slotOf(oldKeys[i], mask);
+            while (stamps[slot] == stamp) slot = (slot + 1) & mask;
+            keys[slot] = oldKeys[i];
+            stamps[slot] = stamp;
+        }
+    }
+
+public:
+    StampedSet() : keys(64), stamps(64, 0) {}
+
+    void clear() {
+        count = 0;
+        if (++stamp == 0) {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+    }
+
+    // True if the key was not in the set.
+    bool insert(uint64_t key) {
+        if (2 * (count + 1) > keys.size()) grow();
+        const size_t mask = keys.size() - 1;
+        for (size_t slot = slotOf(key, mask);; slot = (slot + 1) & mask) {
+            if (stamps[slot] != stamp) {
+                keys[slot] = key;
+                stamps[slot] = stamp;
+                count++;
+                return true;
+            }
+            if (keys[slot] == key) return false;
+        }
+    }
+};
+
+// All configurations of one NPDA run at the current input position.
+// Stacks live in a graph-structured stack: a vertex is one stack symbol
+// and its parents are the stacks that can lie beneath it, so stacks with a
+// common bottom share it and one vertex stands for every stack it tops.
+// Vertex 0 is the empty stack.
+struct NPDARun {
+    struct Vertex {
+        uint32_t parent;      // First parent (NONE for the empty stack)
+        uint32_t moreParents; // Further parents: a list in 'links'
+        uint32_t pops;        // Transitions that popped this vertex at its position: a list in 'links'
+        uint16_t top;         // Stack-top class of the symbol
+    };
+    struct Link { uint32_t value; uint32_t next; };
+    struct Config { uint32_t state; uint32_t vertex; };
+
+    std::vector<Vertex> vertices;
+    std::vector<Link> links;
+    std::vector<Config> configs;   // Closed under epsilon moves, deduplicated
+    std::vector<Config> previous;
+    StampedSet seenConfigs;        // (state, vertex) at this position
+    StampedSet seenEdges;          // (vertex, parent) for vertices of this position
+    std::vector<uint32_t> pushedAt; // Per transition: first vertex of its push at this position
+    std::vector<size_t> pushedStamp;
+    size_t positionStart = 0;      // First vertex created at this position
+    size_t position = 0;
+    bool dead = false;
+
+    // Statistics
+    size_t peakConfigs = 0;
+    size_t totalConfigs = 0;
+    size_t merged = 0;             // Configurations reached again at the same position
+    size_t moves = 0;              // Transitions applied
+};
+
+// Simulates any PDA, deterministic or not, without backtracking. All
+// configurations advance together one input symbol at a time, and two
+// configurations in the same state on the same stack vertex are one.
+//
+// A push at position i by transition t goes to vertices keyed (t, k, i)
+// for the k-th pushed symbol: whatever happens above them depends only on
+// t's target state, the pushed symbols and the input from i on, so every
+// configuration firing t at i shares them and only the parents of the
+// bottom pushed vertex differ. There are at most (transitions x longest
+// push) new vertices and (states x vertices) configurations per position,
+// so a run is polynomial in the input length where backtracking is
+// exponential. Epsilon loops that grow the stack become cycles in the
+// graph and end like everything else.
+//
+// A vertex created at the current position can gain parents after
+// epsilon moves have already popped it, so each such pop is remembered on
+// the vertex and replayed onto every later parent.
+class NPDA {
+private:
+    struct Move { uint32_t to; uint32_t push; uint8_t length; uint8_t pop; };
+    static const uint32_t NONE = 0xFFFFFFFFu;
+    static const uint16_t EMPTY_TOP = 0;
+
+    std::vector<std::string> stateNames;
+    std::vector<char> accepting;
+    bool acceptEmpty = false;
+    uint32_t startState = 0;
+    uint16_t bottomTop = EMPTY_TOP;
+    uint32_t inputOffset[256];
+    size_t topClasses = 1;
+    size_t stateStride = 1;
+    std::vector<Move> moves;            // By transition id
+    std::vector<uint16_t> pushTops;     // Pushed stack-top classes, bottom-first, from Move::push
+    std::vector<uint32_t> readFirst;    // [state * stateStride + inputOffset[c] + top]: range in readIds
+    std::vector<uint32_t> readIds;
+    std::vector<uint32_t> epsilonFirst; // [state * topClasses + top]: range in epsilonIds
+    std::vector<uint32_t> epsilonIds;
+
+    static void index(std::vector<uint32_t>& first, std::vector<uint32_t>& ids,
+                      const std::vector<std::pair<size_t, uint32_t>>& entries, size_t slots) {
+        first.assign(slots + 1, 0);
+        for (const auto& e : entries) first[e.first + 1]++;
+        for (size_t s = 0; s < slots; s++) first[s + 1] += first[s];
+        ids.resize(entries.size());
+        std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+        for (const auto& e : entries) ids[fill[e.first]++] = e.second;
+    }
+
+    void addConfig(NPDARun& run, uint32_t state, uint32_t vertex) const {
+        if (run.seenConfigs.insert(static_cast<uint64_t>(state) << 32 | vertex)) {
+            run.configs.push_back(NPDARun::Config{state, vertex});
+        } else {
+            run.merged++;
+        }
+    }
+
+    // Lands transition t on 'base', the stack left after its pop: pushes
+    // its symbols (sharing them with earlier firings of t here) or, for a
+    // pure pop, enters its target state on base.
+    void land(NPDARun& run, uint32_t t, uint32_t base) const {
+        const Move& m = moves[t];
+        if (m.length == 0) {
+            addConfig(run, m.to, base);
+            return;
+        }
+        if (run.pushedStamp[t] == run.position + 1) {
+            addParent(run, run.pushedAt[t], base);
+            return;
+        }
+        uint32_t first = static_cast<uint32_t>(run.vertices.size());
+        run.pushedStamp[t] = run.position + 1;
+        run.pushedAt[t] = first;
+        for (uint32_t k = 0; k < m.length; k++) {
+            run.vertices.push_back(NPDARun::Vertex{k ? first + k - 1 : base, NONE, NONE, pushTops[m.push + k]});
+        }
+        run.seenEdges.insert(static_cast<uint64_t>(first) << 32 | base);
+        addConfig(run, m.to, first + m.length - 1);
+    }
+
+    void addParent(NPDARun& run, uint32_t vertex, uint32_t parent) const {
+        if (!run.seenEdges.insert(static_cast<uint64_t>(vertex) << 32 | parent)) return;
+        run.links.push_back(NPDARun::Link{parent, run.vertices[vertex].moreParents});
+        run.vertices[vertex].moreParents = static_cast<uint32_t>(run.links.size() - 1);
+        for (uint32_t p = run.vertices[vertex].pops; p != NONE; p = run.links[p].next) {
+            land(run, run.links[p].value, parent);
+        }
+    }
+
+    // Applies transition t to a configuration whose top is 'vertex'.
+    // Recording the pop first lets parents added while landing see it.
+    void fire(NPDARun& run, uint32_t t, uint32_t vertex, bool record) const {
+        run.moves++;
+        if (!moves[t].pop) {
+            land(run, t, vertex);
+            return;
+        }
+        if (record && vertex >= run.positionStart) {
+            run.links.push_back(NPDARun::Link{t, run.vertices[vertex].pops});
+            run.vertices[vertex].pops = static_cast<uint32_t>(run.links.size() - 1);
+        }
+        land(run, t, run.vertices[vertex].parent);
+        for (uint32_t p = run.vertices[vertex].moreParents; p != NONE; p = run.links[p].next) {
+            land(run, t, run.links[p].value);
+        }
+    }
+
+    // Epsilon closure of the configurations of this position; configs is
+    // its own worklist.
+    void close(NPDARun& run) const {
+        for (size_t i = 0; i < run.configs.size(); i++) {
+            const NPDARun::Config c = run.configs[i];
+            size_t slot = c.state * topClasses + run.vertices[c.vertex].top;
+            for (uint32_t e = epsilonFirst[slot]; e < epsilonFirst[slot + 1]; e++) {
+                fire(run, epsilonIds[e], c.vertex, true);
+            }
+        }
+        run.peakConfigs = std::max(run.peakConfigs, run.configs.size());
+        run.totalConfigs += run.configs.size();
+        if (run.configs.empty()) run.dead = true;
+    }
+
+    void beginPosition(NPDARun& run) const {
+        run.seenConfigs.clear();
+        run.seenEdges.clear();
+        run.positionStart = run.vertices.size();
+    }
+
+public:
+    NPDA() { std::memset(inputOffset, 0, sizeof(inputOffset)); }
+
+    bool compile(const PDADefinition& def) {
+        stateNames = def.stateNames;
+        accepting = def.accepting;
+        acceptEmpty = def.acceptEmpty;
+        startState = def.startState;
+        bottomTop = def.bottom.empty() ? EMPTY_TOP : def.topClass[static_cast<unsigned char>(def.bottom[0])];
+        topClasses = def.topClasses;
+        stateStride = def.inputClasses * topClasses;
+        for (int c = 0; c < 256; c++) inputOffset[c] = static_cast<uint32_t>(def.inputClass[c] * topClasses);
+
+        moves.clear();
+        pushTops.clear();
+        std::vector<std::pair<size_t, uint32_t>> reads, epsilons;
+        for (const PDADefinition::Rule& r : def.rules) {
+            uint32_t id = static_cast<uint32_t>(moves.size());
+            moves.push_back(Move{r.to, static_cast<uint32_t>(pushTops.size()), static_cast<uint8_t>(r.push.size()),
+                                 static_cast<uint8_t>(r.top >= 0)});
+            for (size_t k = r.push.size(); k-- > 0;) pushTops.push_back(def.topClass[static_cast<unsigned char>(r.push[k])]);
+            size_t top = r.top < 0 ? EMPTY_TOP : def.topClass[r.top];
+            if (r.input < 0) {
+                epsilons.push_back(std::make_pair(r.from * topClasses + top, id));
+            } else {
+                reads.push_back(std::make_pair(r.from * stateStride + inputOffset[r.input] + top, id));
+            }
+        }
+        index(readFirst, readIds, reads, stateNames.size() * stateStride);
+        index(epsilonFirst, epsilonIds, epsilons, stateNames.size() * topClasses);
+        return true;
+    }
+
+    bool parse(std::istream& in, const std::string& source) {
+        PDADefinition def;
+        return def.parse(in, source) && compile(def);
+    }
+
+    bool load(const std::string& path) {
+        PDADefinition def;
+        return def.load(path) && compile(def);
+    }
+
+    // Starts a run, keeping the memory of any earlier run in it.
+    void start(NPDARun& run) const {
+        run.vertices.clear();
+        run.links.clear();
+        run.configs.clear();
+        run.previous.clear();
+        run.position = 0;
+        run.dead = false;
+        run.peakConfigs = run.totalConfigs = run.merged = run.moves = 0;
+        run.pushedAt.assign(moves.size(), 0);
+        run.pushedStamp.assign(moves.size(), 0);
+        run.vertices.push_back(NPDARun::Vertex{NONE, NONE, NONE, EMPTY_TOP});
+        if (bottomTop != EMPTY_TOP) run.vertices.push_back(NPDARun::Vertex{0, NONE, NONE, bottomTop});
+        beginPosition(run);
+        addConfig(run, startState, static_cast<uint32_t>(run.vertices.size() - 1));
+        close(run);
+    }
+
+    // Consumes n more input bytes; false once no configuration is left.
+    bool feed(NPDARun& run, const char* input, size_t n) const {
+        for (size_t i = 0; i < n && !run.dead; i++) {
+            run.previous.swap(run.configs);
+            run.configs.clear();
+            run.position++;
+            beginPosition(run);
+            const uint32_t offset = inputOffset[static_cast<unsigned char>(input[i])];
+            for (const NPDARun::Config& c : run.previous) {
+                size_t slot = c.state * stateStride + offset + run.vertices[c.vertex].top;
+                for (uint32_t r = readFirst[slot]; r < readFirst[slot + 1]; r++) fire(run, readIds[r], c.vertex, false);
+            }
+            close(run);
+        }
+        return !run.dead;
+    }
+
+    // End of input: accepts if some configuration is in a final state (or,
+    // with accept-empty, has an empty stack). Configurations are already
+    // closed under epsilon moves.
+    bool finish(const NPDARun& run) const {
+        for (const NPDARun::Config& c : run.configs) {
+            if (accepting[c.state] || (acceptEmpty && c.vertex == 0)) return true;
+        }
+        return false;
+    }
+
+    bool accepts(const std::string& input, NPDARun& run) const {
+        start(run);
+        return feed(run, input.data(), input.size()) && finish(run);
+    }
+
+    static void printStats(const NPDARun& run, std::ostream& out) {
+        out << "  positions=" << run.position << "  configs peak=" << run.peakConfigs
+            << " total=" << run.totalConfigs << " merged=" << run.merged << "  moves=" << run.moves
+            << "  stack vertices=" << run.vertices.size() << " links=" << run.links.size() << std::endl;
+    }
+};
+
+// ==========================================
+// CFG-to-PDA Construction
+// ==========================================
+
+// A context-free grammar whose terminals are single characters, so that
+// strings over them can be fed to a PDA byte by byte. Symbols are ints:
+// a terminal is its byte value and variable v is FIRST_VARIABLE + v.
+struct CFG {
+    static const int FIRST_VARIABLE = 256;
+    struct Rule { int head; std::vector<int> body; };
+
+    std::vector<std::string> variableNames;
+    std::vector<Rule> rules;
+    int start = FIRST_VARIABLE;
+
+    static bool isVariable(int symbol) { return symbol >= FIRST_VARIABLE; }
+
+    // S -> a S b | epsilon, the grammar parseCFG recognizes.
+    static CFG anbn() {
+        CFG g;
+        g.variableNames.push_back("S");
+        g.rules.push_back(Rule{FIRST_VARIABLE, {'a', FIRST_VARIABLE, 'b'}});
+        g.rules.push_back(Rule{FIRST_VARIABLE, {}});
+        return g;
+    }
+
+    // Loads a text grammar (format in Common/GrammarReader.h); the head of
+    // the first rule is the start symbol.
+    bool load(const std::string& path) {
+        GrammarReader reader;
+        if (!reader.open(path)) return false;
+        TokenMap<int> interned;
+        variableNames.clear();
+        rules.clear();
+        std::string bad;
+        auto lookup = [&](const GrammarToken& t) {
+            auto found = interned.find(t);
+            if (found != interned.end()) return found->second;
+            int symbol;
+            if (t.isVariable()) {
+                symbol = FIRST_VARIABLE + static_cast<int>(variableNames.size());
+                variableNames.push_back(t.str());
+            } else {
+                if (t.length != 1 && bad.empty()) bad = t.str();
+                symbol = static_cast<unsigned char>(t.text[0]);
+            }
+            interned.emplace(t, symbol);
+            return symbol;
+        };
+        bool ok = reader.read([&](const GrammarToken& head, const GrammarToken* syms, size_t n) {
+            Rule rule{lookup(head), {}};
+            for (size_t i = 0; i < n; i++) rule.body.push_back(lookup(syms[i]));
+            rules.push_back(rule);
+        });
+        if (!ok) return false;
+        if (!bad.empty()) {
+            std::cerr << "Error: " << path << ": terminal '" << bad << "' is not a single character" << std::endl;
+            return false;
+        }
+        if (rules.empty()) {
+            std::cerr << "Error: " << path << ": no rules" << std::endl;
+            return false;
+        }
+        start = rules[0].head;
+        return true;
+    }
+
+    std::string terminals() const {
+        std::vector<char> used(256, 0);
+        for (const Rule& r : rules) {
+            for (int s : r.body) if (!isVariable(s)) used[s] = 1;
+        }
+        std::string out;
+        for (int c = 0; c < 256; c++) if (used[c]) out += static_cast<char>(c);
+        return out;
+    }
+};
+
+// Earley recognizer for any CFG, the reference the generated PDA is
+// checked against. Nullable variables are handled as in Aycock and
+// Horspool: predicting a nullable variable also steps over it, so an item
+// completed at its own origin has nothing left to complete. Every other
+// completion looks up the items waiting for its head in a finished set,
+// which is indexed by next symbol once it is closed.
+class EarleyRecognizer {
+private:
+    struct Item { uint32_t rule; uint32_t dot; uint32_t origin; };
+
+    const CFG* grammar = nullptr;
+    std::vector<std::vector<uint32_t>> byHead;
+    std::vector<char> nullable;
+
+    static uint64_t keyOf(const Item& item) {
+        return static_cast<uint64_t>(item.rule) << 40 | static_cast<uint64_t>(item.dot) << 32 | item.origin;
+    }
+
+    bool isNullable(int symbol) const { return CFG::isVariable(symbol) && nullable[symbol - CFG::FIRST_VARIABLE]; }
+
+public:
+    // Per-thread working memory, reused between strings.
+    struct Scratch {
+        std::vector<std::vector<Item>> sets;
+        std::vector<std::vector<std::pair<int, uint32_t>>> waiting; // Per set: (next variable, item), sorted
+        StampedSet seen;
+    };
+
+    void build(const CFG& g) {
+        grammar = &g;
+        byHead.assign(g.variableNames.size(), std::vector<uint32_t>());
+        for (size_t r = 0; r < g.rules.size(); r++) byHead[g.rules[r].head - CFG::FIRST_VARIABLE].push_back(static_cast<uint32_t>(r));
+        nullable.assign(g.variableNames.size(), 0);
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const CFG::Rule& r : g.rules) {
+                if (nullable[r.head - CFG::FIRST_VARIABLE]) continue;
+                bool all = true;
+                for (int s : r.body) all = all && isNullable(s);
+                if (all) {
+                    nullable[r.head - CFG::FIRST_VARIABLE] = 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool accepts(const std::string& input, Scratch& scratch) const {
+        const std::vector<CFG::Rule>& rules = grammar->rules;
+        const size_t n = input.size();
+        if (scratch.sets.size() < n + 1) {
+            scratch.sets.resize(n + 1);
+            scratch.waiting.resize(n + 1);
+        }
+        std::vector<std::vector<Item>>& sets = scratch.sets;
+        auto add = [&](size_t at, const Item& item) {
+            if (scratch.seen.insert(keyOf(item))) sets[at].push_back(item);
+        };
+
+        sets[0].clear();
+        scratch.seen.clear();
+        for (uint32_t r : byHead[grammar->start - CFG::FIRST_VARIABLE]) add(0, Item{r, 0, 0});
+        for (size_t i = 0;; i++) {
+            // Predict and complete until set i is closed.
+            for (size_t k = 0; k < sets[i].size(); k++) {
+                const Item item = sets[i][k];
+                const std::vector<int>& body = rules[item.rule].body;
+                if (item.dot == body.size()) {
+                    if (item.origin == i) continue;
+                    const std::vector<std::pair<int, uint32_t>>& index = scratch.waiting[item.origin];
+                    const int head = rules[item.rule].head;
+                    auto at = std::lower_bound(index.begin(), index.end(), std::make_pair(head, 0u));
+                    for (; at != index.end() && at->first == head; ++at) {
+                        const Item waiting = sets[item.origin][at->second];
+                        add(i, Item{waiting.rule, waiting.dot + 1, waiting.origin});
+                    }
+                } else if (CFG::isVariable(body[item.dot])) {
+                    for (uint32_t r : byHead[body[item.dot] - CFG::FIRST_VARIABLE]) add(i, Item{r, 0, static_cast<uint32_t>(i)});
+                    if (isNullable(body[item.dot])) add(i, Item{item.rule, item.dot + 1, item.origin});
+                }
+            }
+            if (i == n) break;
+
+            std::vector<std::pair<int, uint32_t>>& index = scratch.waiting[i];
+            index.clear();
+            for (size_t k = 0; k < sets[i].size(); k++) {
+                const Item& item = sets[i][k];
+                const std::vector<int>& body = rules[item.rule].body;
+                if (item.dot < body.size() && CFG::isVariable(body[item.dot])) {
+                    index.push_back(std::make_pair(body[item.dot], static_cast<uint32_t>(k)));
+                }
+            }
+            std::sort(index.begin(), index.end());
+
+            // Scan input[i] into set i + 1.
+            sets[i + 1].clear();
+            scratch.seen.clear();
+            const int c = static_cast<unsigned char>(input[i]);
+            for (const Item& item : sets[i]) {
+                const std::vector<int>& body = rules[item.rule].body;
+                if (item.dot < body.size() && body[item.dot] == c) add(i + 1, Item{item.rule, item.dot + 1, item.origin});
+            }
+            if (sets[i + 1].empty()) return false;
+        }
+        for (const Item& item : sets[n]) {
+            if (item.origin == 0 && rules[item.rule].head == grammar->start && item.dot == rules[item.rule].body.size()) return true;
+        }
+        return false;
+    }
+};
+
+// The textbook PDA for a grammar, accepting by final state:
+//
+//     q_start eps -   -> q_loop   S$     # start symbol over a bottom marker
+//     q_loop  eps A   -> q_loop   w      # for every rule A -> w
+//     q_loop  a   a   -> q_loop   eps    # for every terminal a
+//     q_loop  eps $   -> q_accept eps
+//
+// Stack symbols are bytes: terminals stand for themselves, and variables
+// and the marker take bytes no terminal uses (a one-character variable
+// name keeps its own character when it is free).
+bool buildPDA(const CFG& g, PDADefinition& def) {
+    std::vector<char> taken(256, 0);
+    taken[0] = 1;
+    for (char c : g.terminals()) taken[static_cast<unsigned char>(c)] = 1;
+    std::vector<unsigned char> byteOf(g.variableNames.size(), 0);
+    for (size_t v = 0; v < g.variableNames.size(); v++) {
+        const std::string& name = g.variableNames[v];
+        unsigned char c = static_cast<unsigned char>(name[0]);
+        if (name.size() == 1 && !taken[c]) {
+            byteOf[v] = c;
+            taken[c] = 1;
+        }
+    }
+    // Printable bytes first, so small grammars print readably.
+    auto freeByte = [&]() -> int {
+        for (int c = '!'; c < 256; c++) {
+            if (!taken[c] && c != 127) {
+                taken[c] = 1;
+                return c;
+            }
+        }
+        return -1;
+    };
+    int marker = taken['$'] ? freeByte() : '$';
+    if (marker == '$') taken['$'] = 1;
+    for (size_t v = 0; v < g.variableNames.size(); v++) {
+        if (byteOf[v]) continue;
+        int c = freeByte();
+        if (c < 0 || marker < 0) {
+            std::cerr << "Error: too many symbols for a byte stack alphabet" << std::endl;
+            return false;
+        }
+        byteOf[v] = static_cast<unsigned char>(c);
+    }
+    auto stackByte = [&](int symbol) {
+        return static_cast<char>(CFG::isVariable(symbol) ? byteOf[symbol - CFG::FIRST_VARIABLE] : symbol);
+    };
+
+    enum { Q_START, Q_LOOP, Q_ACCEPT };
+    def = PDADefinition();
+    def.source = "CFG";
+    def.stateNames = {"q_start", "q_loop", "q_accept"};
+    def.startState = Q_START;
+    def.accepting = {0, 0, 1};
+    std::string first;
+    first += stackByte(g.start);
+    first += static_cast<char>(marker);
+    def.rules.push_back(PDADefinition::Rule{Q_START, -1, -1, Q_LOOP, first, 0});
+    for (const CFG::Rule& r : g.rules) {
+        std::string push;
+        for (int s : r.body) push += stackByte(s);
+        if (push.size() > 255) {
+            std::cerr << "Error: a body of " << g.variableNames[r.head - CFG::FIRST_VARIABLE] << " is longer than 255" << std::endl;
+            return false;
+        }
+        def.rules.push_back(PDADefinition::Rule{Q_LOOP, -1, static_cast<unsigned char>(stackByte(r.head)), Q_LOOP, push, 0});
+    }
+    for (char c : g.terminals()) {
+        def.rules.push_back(PDADefinition::Rule{Q_LOOP, static_cast<unsigned char>(c), static_cast<unsigned char>(c), Q_LOOP, "", 0});
+    }
+    def.rules.push_back(PDADefinition::Rule{Q_LOOP, -1, marker, Q_ACCEPT, "", 0});
+    def.classify();
+    return true;
+}
+
+// ==========================================
+// Differential Testing
+// ==========================================
+
+struct DifferentialOptions {
+    size_t count = 1000000;  // Strings to test
+    size_t maxLength = 16;
+    unsigned threads = 0;    // 0: one per core
+    uint64_t seed = 1;
+};
+
+// Generates test strings for a grammar: a third are random derivations
+// (mostly members), a third are derivations with one character changed,
+// inserted or deleted (near misses), and a third are uniformly random
+// strings over the terminals.
+class StringGenerator {
+private:
+    const CFG& g;
+    size_t maxLength;
+    std::string alphabet;
+    std::vector<size_t> minYield;   // Per variable: shortest terminal string
+    std::vector<size_t> height;     // Per variable: lowest derivation tree
+    std::vector<std::vector<uint32_t>> byHead;
+    std::vector<uint32_t> lowestRule; // Per variable: the rule its height comes from; NO_RULE if unproductive
+
+    size_t yieldOf(int symbol) const { return CFG::isVariable(symbol) ? minYield[symbol - CFG::FIRST_VARIABLE] : 1; }
+
+    // Shortest yield of a rule body, saturating at UNPRODUCTIVE.
+    size_t yieldOf(const std::vector<int>& body) const {
+        size_t yield = 0;
+        for (int s : body) yield = std::min(UNPRODUCTIVE, yield + yieldOf(s));
+        return yield;
+    }
+
+public:
+    static const size_t UNPRODUCTIVE = ~static_cast<size_t>(0) / 4;
+    static const uint32_t NO_RULE = ~static_cast<uint32_t>(0);
+
+    StringGenerator(const CFG& grammar, size_t limit) : g(grammar), maxLength(limit), alphabet(grammar.terminals()) {
+        const size_t V = g.variableNames.size();
+        minYield.assign(V, UNPRODUCTIVE);
+        height.assign(V, UNPRODUCTIVE);
+        lowestRule.assign(V, NO_RULE);
+        byHead.assign(V, std::vector<uint32_t>());
+        for (size_t r = 0; r < g.rules.size(); r++) byHead[g.rules[r].head - CFG::FIRST_VARIABLE].push_back(static_cast<uint32_t>(r));
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t r = 0; r < g.rules.size(); r++) {
+                const CFG::Rule& rule = g.rules[r];
+                size_t yield = yieldOf(rule.body), h = 1;
+                for (int s : rule.body) {
+                    if (CFG::isVariable(s)) h = std::max(h, height[s - CFG::FIRST_VARIABLE] + 1);
+                }
+                const size_t v = rule.head - CFG::FIRST_VARIABLE;
+                if (yield < minYield[v]) { minYield[v] = yield; changed = true; }
+                if (h < height[v]) { height[v] = h; lowestRule[v] = static_cast<uint32_t>(r); changed = true; }
+            }
+        }
+    }
+
+    bool productive() const { return minYield[g.start - CFG::FIRST_VARIABLE] < UNPRODUCTIVE; }
+
+    // Expands the leftmost variable with a random rule that keeps the
+    // shortest possible result within maxLength, switching to the lowest
+    // rules once the derivation has run long, so every derivation ends.
+    // Only productive rules are chosen, so every variable expanded has one.
+    bool derive(std::mt19937_64& rng, std::string& out) const {
+        out.clear();
+        if (!productive()) return false;
+        std::vector<int> pending(1, g.start);
+        size_t committed = yieldOf(g.start);
+        if (committed > maxLength) return false;
+        for (size_t steps = 0; !pending.empty(); steps++) {
+            int s = pending.back();
+            pending.pop_back();
+            if (!CFG::isVariable(s)) {
+                out += static_cast<char>(s);
+                continue;
+            }
+            const size_t v = s - CFG::FIRST_VARIABLE;
+            if (lowestRule[v] == NO_RULE) return false;
+            committed -= minYield[v];
+            uint32_t chosen = lowestRule[v];
+            if (steps < 4 * maxLength + 16) {
+                uint32_t candidates[8];
+                size_t count = 0;
+                const std::vector<uint32_t>& options = byHead[v];
+                for (size_t tries = 0; tries < 8 && count < 8; tries++) {
+                    uint32_t r = options[rng() % options.size()];
+                    size_t yield = yieldOf(g.rules[r].body);
+                    if (yield < UNPRODUCTIVE && committed + yield <= maxLength) candidates[count++] = r;
+                }
+                if (count) chosen = candidates[rng() % count];
+            }
+            const std::vector<int>& body = g.rules[chosen].body;
+            for (size_t k = body.size(); k-- > 0;) {
+                pending.push_back(body[k]);
+                committed += yieldOf(body[k]);
+            }
+        }
+        return true;
+    }
+
+    void next(std::mt19937_64& rng, std::string& out) const {
+        unsigned kind = rng() % 3;
+        if (kind < 2 && productive() && derive(rng, out)) {
+            if (kind == 1 && !alphabet.empty()) {
+                size_t at = out.empty() ? 0 : rng() % (out.size() + 1);
+                unsigned edit = rng() % 3;
+                if (edit == 0 && at < out.size()) out[at] = alphabet[rng() % alphabet.size()];
+                else if (edit == 1 || out.empty()) out.insert(out.begin() + at, alphabet[rng() % alphabet.size()]);
+                else out.erase(out.begin() + std::min(at, out.size() - 1));
+            }
+            return;
+        }
+        out.clear();
+        if (alphabet.empty()) return;
+        size_t length = rng() % (maxLength + 1);
+        for (size_t i = 0; i < length; i++) out += alphabet[rng() % alphabet.size()];
+    }
+};
+
+const size_t StringGenerator::UNPRODUCTIVE;
+const uint32_t StringGenerator::NO_RULE;
+
+struct DifferentialReport {
+    size_t strings = 0;
+    size_t symbols = 0;
+    size_t accepted = 0;
+    size_t disagreements = 0;
+    size_t peakConfigs = 0;
+    double seconds = 0;
+    std::vector<std::string> examples; // First few disagreements
+};
+
+// Runs the Earley recognizer and the PDA built from the same grammar on
+// generated strings across threads and compares the verdicts. With
+// handWritten set (the a^n b^n grammar), simulatePDA and parseCFG are
+// checked as well. Threads take strings in batches from a shared counter
+// and each has its own generator seed and working memory.
+bool runDifferential(const CFG& g, bool handWritten, const DifferentialOptions& options, DifferentialReport& report) {
+    PDADefinition def;
+    if (!buildPDA(g, def)) return false;
+    NPDA pda;
+    pda.compile(def);
+    EarleyRecognizer earley;
+    earley.build(g);
+    StringGenerator generator(g, options.maxLength);
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    const size_t BATCH = 1024;
+    std::atomic<size_t> next(0);
+    std::mutex lock;
+    report = DifferentialReport();
+    auto begin = std::chrono::steady_clock::now();
+
+    auto worker = [&](unsigned id) {
+        std::mt19937_64 rng(options.seed * 0x9E3779B97F4A7C15ull + id);
+        EarleyRecognizer::Scratch scratch;
+        NPDARun run;
+        std::string s;
+        size_t strings = 0, symbols = 0, accepted = 0, disagreements = 0, peak = 0;
+        for (;;) {
+            size_t first = next.fetch_add(BATCH);
+            if (first >= options.count) break;
+            size_t last = std::min(options.count, first + BATCH);
+            for (size_t k = first; k < last; k++) {
+                generator.next(rng, s);
+                bool expected = earley.accepts(s, scratch);
+                bool viaPDA = pda.accepts(s, run);
+                peak = std::max(peak, run.peakConfigs);
+                bool agree = viaPDA == expected;
+                bool pdaDemo = expected, cfgDemo = expected;
+                if (handWritten) {
+                    pdaDemo = simulatePDA(s);
+                    cfgDemo = parseCFG(s);
+                    agree = agree && pdaDemo == expected && cfgDemo == expected;
+                }
+                strings++;
+                symbols += s.size();
+                accepted += expected;
+                if (agree) continue;
+                disagreements++;
+                std::lock_guard<std::mutex> guard(lock);
+                if (report.examples.size() < 10) {
+                    std::string line = "\"" + s + "\"  earley=" + (expected ? "ACCEPT" : "REJECT") +
+                                       "  pda=" + (viaPDA ? "ACCEPT" : "REJECT");
+                    if (handWritten) {
+                        line += std::string("  simulatePDA=") + (pdaDemo ? "ACCEPT" : "REJECT") +
+                                "  parseCFG=" + (cfgDemo ? "ACCEPT" : "REJECT");
+                    }
+                    report.examples.push_back(line);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        report.strings += strings;
+        report.symbols += symbols;
+        report.accepted += accepted;
+        report.disagreements += disagreements;
+        report.peakConfigs = std::max(report.peakConfigs, peak);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker, t);
+    worker(0);
+    for (std::thread& t : pool) t.join();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return report.disagreements == 0;
+}
+
+// ==========================================
+// Streaming Input
+// ==========================================
+
+// simulatePDA as a resumable recognizer: input arrives in pieces through
+// feed(), in any split, and finish() gives the verdict. Only '$' is ever
+// pushed, so the stack is kept as its height, and a run of one character
+// moves it by the run's length at once.
+class StreamingPDA {
+private:
+    enum State { q_start, q_read_b };
+    State state = q_start;
+    uint64_t height = 0;
+    uint64_t offset = 0;   // Input consumed so far
+    bool dead = false;
+
+public:
+    void reset() {
+        state = q_start;
+        height = 0;
+        offset = 0;
+        dead = false;
+    }
+
+    // False once the input so far can't be extended to an accepted string.
+    bool feed(const char* data, size_t n) {
+        if (dead) return false;
+        State q = state;
+        uint64_t h = height;
+        size_t i = 0;
+        while (i < n) {
+            if (data[i] == 'a' && q == q_start) {
+                size_t run = runLength(data + i, n - i, 'a');
+                h += run;           // Push '$' per 'a'
+                i += run;
+            } else if (data[i] == 'b' && h > 0) {
+                size_t run = static_cast<size_t>(std::min<uint64_t>(runLength(data + i, n - i, 'b'), h));
+                q = q_read_b;       // Pop '$' per 'b'
+                h -= run;
+                i += run;
+            } else {
+                dead = true;        // Invalid character, 'a' after 'b', or pop from an empty stack
+                break;
+            }
+        }
+        state = q;
+        height = h;
+        offset += i;
+        return !dead;
+    }
+
+    bool finish() const { return !dead && height == 0; }
+    uint64_t consumed() const { return offset; }
+};
+
+// parseCFG as a resumable recognizer, built on parseSIterative: leading
+// 'a's open levels of S -> aSb, then every 'b' closes one, and parseCFG
+// needs the whole input used up when the last level closes. Runs are
+// counted whole, as in StreamingPDA.
+class StreamingCFG {
+private:
+    bool descending = true; // Still reading the leading 'a's
+    uint64_t open = 0;
+    uint64_t offset = 0;
+    bool dead = false;
+
+public:
+    void reset() {
+        descending = true;
+        open = 0;
+        offset = 0;
+        dead = false;
+    }
+
+    bool feed(const char* data, size_t n) {
+        if (dead) return false;
+        bool down = descending;
+        uint64_t levels = open;
+        size_t i = 0;
+        while (i < n) {
+            if (down && data[i] == 'a') {
+                size_t run = runLength(data + i, n - i, 'a');
+                levels += run;
+                i += run;
+            } else if (levels > 0 && data[i] == 'b') {
+                size_t run = static_cast<size_t>(std::min<uint64_t>(runLength(data + i, n - i, 'b'), levels));
+                down = false;
+                levels -= run;
+                i += run;
+            } else {
+                dead = true;    // 'a' not followed by 'b', or input left after S
+                break;
+            }
+        }
+        descending = down;
+        open = levels;
+        offset += i;
+        return !dead;
+    }
+
+    bool finish() const { return !dead && open == 0; }
+    uint64_t consumed() const { return offset; }
+};
+
+// Reads a file ("-": standard input) chunk by chunk and passes the bytes
+// to 'consume' until it returns false or the input ends. Chunks come from
+// read() into one reused buffer, or with useMmap from mapping one
+// chunk-sized window of the file at a time, so memory stays at one chunk
+// whatever the file size. One trailing newline ("\n" or "\r\n") is not
+// passed on, so a file holding one line is read as that line; the last
+// two bytes are held back until the end of input decides.
+class ChunkedReader {
+private:
+    std::string path;
+    size_t chunk;
+    bool useMmap;
+    std::string held;
+    uint64_t delivered = 0;
+
+    bool pass(const std::function<bool(const char*, size_t)>& consume, const char* data, size_t n) {
+        if (!n) return true;
+        delivered += n;
+        return consume(data, n);
+    }
+
+    bool take(const std::function<bool(const char*, size_t)>& consume, const char* data, size_t n) {
+        if (n >= 2) {
+            if (!pass(consume, held.data(), held.size())) return false;
+            held.assign(data + n - 2, 2);
+            return pass(consume, data, n - 2);
+        }
+        held.append(data, n);
+        if (held.size() <= 2) return true;
+        size_t extra = held.size() - 2;
+        bool more = pass(consume, held.data(), extra);
+        held.erase(0, extra);
+        return more;
+    }
+
+    void flush(const std::function<bool(const char*, size_t)>& consume) {
+        if (held.size() >= 1 && held[held.size() - 1] == '\n') {
+            held.erase(held.size() - 1);
+            if (!held.empty() && held[held.size() - 1] == '\r') held.erase(held.size() - 1);
+        }
+        pass(consume, held.data(), held.size());
+        held.clear();
+    }
+
+public:
+    ChunkedReader(const std::string& file, size_t chunkBytes, bool mapped)
+        : path(file), chunk(std::max<size_t>(chunkBytes, 1)), useMmap(mapped) {}
+
+    // Bytes passed to the consumer.
+    uint64_t bytes() const { return delivered; }
+
+    // False if the input couldn't be read.
+    bool run(const std::function<bool(const char*, size_t)>& consume) {
+        held.clear();
+        delivered = 0;
+#ifdef _WIN32
+        std::ifstream file;
+        std::istream* in = &std::cin;
+        if (path != "-") {
+            file.open(path.c_str(), std::ios::binary);
+            if (!file) {
+                std::cerr << "Error: cannot open " << path << std::endl;
+                return false;
+            }
+            in = &file;
+        }
+        std::vector<char> buffer(chunk);
+        while (*in) {
+            in->read(buffer.data(), buffer.size());
+            if (in->gcount() > 0 && !take(consume, buffer.data(), static_cast<size_t>(in->gcount()))) return true;
+        }
+        flush(consume);
+        return true;
+#else
+        int fd = path == "-" ? 0 : ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: cannot open " << path << std::endl;
+            return false;
+        }
+        struct stat st;
+        bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        bool ok = true;
+        bool more = true;
+        if (useMmap && regular) {
+            // Windows start on page boundaries.
+            const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            const size_t window = (chunk + page - 1) / page * page;
+            const uint64_t size = static_cast<uint64_t>(st.st_size);
+            for (uint64_t at = 0; at < size && more; at += window) {
+                size_t length = static_cast<size_t>(std::min<uint64_t>(window, size - at));
+                void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(at));
+                if (mapped == MAP_FAILED) {
+                    std::cerr << "Error: mmap failed on " << path << std::endl;
+                    ok = false;
+                    break;
+                }
+                madvise(mapped, length, MADV_SEQUENTIAL);
+                more = take(consume, static_cast<const char*>(mapped), length);
+                munmap(mapped, length);
+            }
+        } else {
+#ifdef POSIX_FADV_SEQUENTIAL
+            if (regular) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            std::vector<char> buffer(chunk);
+            while (more) {
+                ssize_t got = ::read(fd, buffer.data(), buffer.size());
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0) {
+                    std::cerr << "Error: read failed on " << path << std::endl;
+                    ok = false;
+                    break;
+                }
+                if (got == 0) break;
+                more = take(consume, buffer.data(), static_cast<size_t>(got));
+            }
+        }
+        if (ok && more) flush(consume);
+        if (fd != 0) ::close(fd);
+        return ok;
+#endif
+    }
+};
+
+// Streams a file through the resumable PDA and CFG recognizers, and the
+// DPDA from a definition file if one is given, stopping early once all of
+// them have rejected. The DPDA keeps its stack in the automatic layout (or
+// a counter), so long runs of one symbol take constant memory even for
+// inputs larger than memory.
+bool runStream(const std::string& path, size_t chunk, bool useMmap, const std::string& definition) {
+    StreamingPDA pda;
+    StreamingCFG cfg;
+    DPDA machine;
+    DPDARun run;
+    const bool table = !definition.empty();
+    if (table) {
+        if (!machine.load(definition)) return false;
+        machine.start(run);
+    }
+    bool pdaAlive = true, cfgAlive = true, tableAlive = table;
+
+    ChunkedReader reader(path, chunk, useMmap);
+    auto begin = std::chrono::steady_clock::now();
+    bool ok = reader.run([&](const char* data, size_t n) {
+        if (pdaAlive) pdaAlive = pda.feed(data, n);
+        if (cfgAlive) cfgAlive = cfg.feed(data, n);
+        if (tableAlive) tableAlive = machine.feed(run, data, n);
+        return pdaAlive || cfgAlive || tableAlive;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (!ok) return false;
+
+    std::cout << "Streamed " << reader.bytes() << " bytes in " << seconds << " s ("
+              << reader.bytes() / seconds / 1e9 << " GB/s) with " << (useMmap ? "mmap" : "read") << ", "
+              << chunk << "-byte chunks" << std::endl;
+    auto verdict = [&](const char* name, bool accepted, bool alive, uint64_t consumed) {
+        std::cout << name << (accepted ? "ACCEPT" : "REJECT");
+        if (!alive) std::cout << "  (rejected at byte " << consumed << ")";
+        std::cout << std::endl;
+    };
+    verdict("1. PDA Simulator Result: ", pda.finish(), pdaAlive, pda.consumed());
+    verdict("2. CFG Parser Result:    ", cfg.finish(), cfgAlive, cfg.consumed());
+    if (table) verdict("3. Table DPDA Result:    ", machine.finish(run), tableAlive, run.consumed);
+    return true;
+}
+
+template <typename Machine>
+bool parseBuiltIn(Machine& machine, const char* definition, const char* name) {
+    std::istringstream in(definition);
+    return machine.parse(in, name);
+}
+
+// Times simulatePDA against the table engine, in each of its stack modes,
+// and the GSS simulator running the same machine (SIMULATE_PDA_DEFINITION)
+// on a^n b^n; the GSS simulator keeps a vertex per pushed symbol, so it
+// gets at most 10^7 symbols. Then the GSS simulator on even palindromes
+// a^m, where every position is a consistent guess for the middle and the
+// configuration count grows with m.
+void runBenchmark(size_t n) {
+    std::string input(n, 'a');
+    input.append(n, 'b');
+    DPDA counter, bytes, runs;
+    NPDA general, palindromes;
+    if (!parseBuiltIn(counter, SIMULATE_PDA_DEFINITION, "SIMULATE_PDA_DEFINITION") ||
+        !parseBuiltIn(bytes, SIMULATE_PDA_DEFINITION, "SIMULATE_PDA_DEFINITION") ||
+        !parseBuiltIn(runs, SIMULATE_PDA_DEFINITION, "SIMULATE_PDA_DEFINITION") ||
+        !parseBuiltIn(general, SIMULATE_PDA_DEFINITION, "SIMULATE_PDA_DEFINITION") ||
+        !parseBuiltIn(palindromes, EVEN_PALINDROME_DEFINITION, "EVEN_PALINDROME_DEFINITION")) {
+        return;
+    }
+    bytes.setStackMode(DPDA::StackMode::Bytes);
+    runs.setStackMode(DPDA::StackMode::Runs);
+    DPDARun dpdaRun;
+    NPDARun npdaRun;
+
+    auto time = [&](const char* name, const std::string& s, const std::function<bool(const std::string&)>& recognize) {
+        auto begin = std::chrono::steady_clock::now();
+        bool accepted = recognize(s);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << name << "  length=" << s.size() << "  " << (accepted ? "ACCEPT" : "REJECT") << "  time=" << seconds
+                  << "s  (" << s.size() / seconds / 1e6 << " M symbols/s)" << std::endl;
+    };
+    time("simulatePDA        ", input, [](const std::string& s) { return simulatePDA(s); });
+    for (const DPDA* machine : {&counter, &runs, &bytes}) {
+        std::string name = std::string("table DPDA, ") + DPDA::modeName(machine->stackMode());
+        name.resize(19, ' ');
+        time(name.c_str(), input, [&](const std::string& s) { return machine->accepts(s, dpdaRun); });
+        std::cout << "  stack memory=" << machine->stackBytes(dpdaRun) << " bytes" << std::endl;
+    }
+    std::string shorter = input.size() > 20000000 ? std::string(10000000, 'a') + std::string(10000000, 'b') : input;
+    time("GSS NPDA           ", shorter, [&](const std::string& s) { return general.accepts(s, npdaRun); });
+    NPDA::printStats(npdaRun, std::cout);
+    for (size_t m = 1000; m <= 4000; m *= 2) {
+        time("palindrome         ", std::string(m, 'a'), [&](const std::string& s) { return palindromes.accepts(s, npdaRun); });
+        NPDA::printStats(npdaRun, std::cout);
+    }
+}
+
+// Checks parseSIterative against parseS (result and final index) on every
+// string over {a, b, x} up to length 12, then runs parseCFG and simulatePDA
+// on inputs nested n deep, far past where parseS would overflow the stack.
+bool runStressTest(size_t n) {
+    size_t strings = 0;
+    for (size_t length = 0; length <= 12; length++) {
+        size_t count = 1;
+        for (size_t i = 0; i < length; i++) count *= 3;
+        std::string s(length, ' ');
+        for (size_t k = 0; k < count; k++, strings++) {
+            for (size_t i = 0, x = k; i < length; i++, x /= 3) s[i] = "abx"[x % 3];
+            size_t recursive = 0, iterative = 0;
+            if (parseS(s, recursive) != parseSIterative(s, iterative) || recursive != iterative) {
+                std::cout << "MISMATCH  \"" << s << "\"  parseS index=" << recursive
+                          << "  parseSIterative index=" << iterative << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cout << "parseSIterative matches parseS on " << strings << " strings" << std::endl;
+
+    struct Case { const char* name; size_t as, bs; bool expected; };
+    const Case cases[] = {
+        {"a^n b^n    ", n, n, true},
+        {"a^n b^(n-1)", n, n - 1, false},
+        {"a^n b^(n+1)", n, n + 1, false},
+    };
+    bool ok = true;
+    for (const Case& c : cases) {
+        std::string input(c.as, 'a');
+        input.append(c.bs, 'b');
+        auto begin = std::chrono::steady_clock::now();
+        bool cfg = parseCFG(input);
+        double cfgSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        begin = std::chrono::steady_clock::now();
+        bool pda = simulatePDA(input);
+        double pdaSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        bool pass = cfg == c.expected && pda == c.expected;
+        ok = ok && pass;
+        std::cout << c.name << "  n=" << n << "  parseCFG=" << (cfg ? "ACCEPT" : "REJECT") << " (" << cfgSeconds
+                  << "s)  simulatePDA=" << (pda ? "ACCEPT" : "REJECT") << " (" << pdaSeconds << "s)  "
+                  << (pass ? "ok" : "WRONG") << std::endl;
+    }
+    return ok;
+}
+
+// Usage:
+//   CFG-PDA_Equivalence_Example              interactive demo: compare the PDA and the CFG
+//                                            parser on strings typed by the user
+//   CFG-PDA_Equivalence_Example --pda file [--runs] [string...]
+//                                            run the DPDA defined in file (format above
+//                                            DPDA) on each string, or on each line of stdin;
+//                                            --runs always keeps its stack as runs of equal
+//                                            symbols instead of choosing per run
+//   CFG-PDA_Equivalence_Example --npda file [string...]
+//                                            the same for any PDA, deterministic or not,
+//                                            printing configuration statistics per string
+//   CFG-PDA_Equivalence_Example --bench [n]  time simulatePDA against the table engine and
+//                                            the NPDA simulator on a^n b^n (default n = 10^7)
+//   CFG-PDA_Equivalence_Example --stress [n] check parseCFG's iterative parser against the
+//                                            recursive parseS, then run both recognizers on
+//                                            inputs nested n deep (default n = 10^8)
+//   CFG-PDA_Equivalence_Example --stream file [--chunk bytes] [--mmap] [--pda definition]
+//                                            run the PDA and CFG recognizers (and a DPDA, if
+//                                            given) over a file of any size ("-": stdin), read
+//                                            in chunks (default 4 MiB); one trailing newline
+//                                            is ignored
+//   CFG-PDA_Equivalence_Example --cfg-to-pda grammar
+//                                            print the PDA built from a grammar file
+//                                            (format in Common/GrammarReader.h)
+//   CFG-PDA_Equivalence_Example --differential [grammar] [--count n] [--threads t]
+//                                            [--max-length L] [--seed s]
+//                                            run an Earley recognizer and the PDA built from
+//                                            the grammar on n generated strings (default 10^6)
+//                                            and report disagreements and throughput; without
+//                                            a grammar, a^n b^n, also checking simulatePDA and
+//                                            parseCFG. Exits 1 on any disagreement
+int main(int argc, char* argv[]) {
+    if (argc > 2 && (std::string(argv[1]) == "--pda" || std::string(argv[1]) == "--npda")) {
+        const bool general = std::string(argv[1]) == "--npda";
+        DPDA machine;
+        NPDA npda;
+        NPDARun run;
+        if (!(general ? npda.load(argv[2]) : machine.load(argv[2]))) return 1;
+        int first = 3;
+        if (!general && argc > 3 && std::string(argv[3]) == "--runs") {
+            if (machine.stackMode() != DPDA::StackMode::Counter) machine.setStackMode(DPDA::StackMode::Runs);
+            first = 4;
+        }
+        auto report = [&](const std::string& s) {
+            bool accepted = general ? npda.accepts(s, run) : machine.accepts(s);
+            std::cout << (accepted ? "ACCEPT" : "REJECT") << "  \"" << s << "\"" << std::endl;
+            if (general) NPDA::printStats(run, std::cout);
+        };
+        if (argc > first) {
+            for (int i = first; i < argc; i++) report(argv[i]);
+        } else {
+            for (std::string line; std::getline(std::cin, line);) report(line);
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmark(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--stress") {
+        size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000000;
+        return runStressTest(std::max<size_t>(n, 1)) ? 0 : 1;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--stream") {
+        size_t chunk = 4 << 20;
+        bool useMmap = false;
+        std::string definition;
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--chunk" && i + 1 < argc) {
+                chunk = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--mmap") {
+                useMmap = true;
+            } else if (arg == "--pda" && i + 1 < argc) {
+                definition = argv[++i];
+            } else {
+                std::cerr << "Error: unknown option " << arg << std::endl;
+                return 1;
+            }
+        }
+        return runStream(argv[2], chunk, useMmap, definition) ? 0 : 1;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--cfg-to-pda") {
+        CFG g;
+        PDADefinition def;
+        if (!g.load(argv[2]) || !buildPDA(g, def)) return 1;
+        def.write(std::cout);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--differential") {
+        CFG g = CFG::anbn();
+        bool handWritten = true;
+        DifferentialOptions options;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--count" && i + 1 < argc) {
+                options.count = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--threads" && i + 1 < argc) {
+                options.threads = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--max-length" && i + 1 < argc) {
+                options.maxLength = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--seed" && i + 1 < argc) {
+                options.seed = std::strtoull(argv[++i], nullptr, 10);
+            } else {
+                if (!g.load(arg)) return 1;
+                handWritten = false;
+            }
+        }
+
+        DifferentialReport report;
+        bool same = runDifferential(g, handWritten, options, report);
+        std::cout << "strings=" << report.strings << "  accepted=" << report.accepted
+                  << "  disagreements=" << report.disagreements << "  peak PDA configs=" << report.peakConfigs
+                  << "  time=" << report.seconds << "s  (" << report.strings / report.seconds << " strings/s, "
+                  << report.symbols / report.seconds / 1e6 << " M symbols/s)" << std::endl;
+        for (const std::string& example : report.examples) std::cout << "  " << example << std::endl;
+        return same ? 0 : 1;
+    }
+
     std::string userInput;
     int test_cases;
     std::cout << "--- CFG-PDA Equivalence Demo for L = {a^n b^n} ---" << std::endl;
@@ -5,6 +5,67 @@
 #include <set>
 #include <cctype>
 #include <limits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include "../Common/GrammarReader.h"
+
+// ==========================================
+// Compiled Grammar Image (.cnfb)
+// ==========================================
+// A CNF grammar compiled into a flat, versioned binary image that the CYK
+// parser can use straight from a memory mapping, with no rebuilding of
+// reverse_rules at startup. Every offset is relative to the start of the
+// file, so the image is position-independent.
+//
+// Layout:
+//   CompiledHeader
+//   symbol table : num_vars bytes, the variable character for each id
+//   terminal map : 256 x uint32, bitmask of variables A with A -> c
+//   rule index   : num_vars * num_vars x uint32, bitmask of A with A -> BC
+//   rule list    : num_rules x 4 bytes {head, body[0], body[1], body length}
+//
+// Variables are single upper-case letters, so a uint32 bitmask holds any
+// set of them and a CYK cell becomes a single integer.
+
+const char COMPILED_MAGIC[4] = {'C', 'N', 'F', 'B'};
+const uint32_t COMPILED_VERSION = 1;
+const uint32_t COMPILED_ENDIAN_TAG = 0x01020304;
+const uint32_t NO_START_SYMBOL = 0xFFFFFFFFu;
+
+struct CompiledHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t endian_tag;      // Rejects images written on a machine of the other byte order
+    uint32_t header_size;
+    uint32_t file_size;
+    uint32_t num_vars;
+    uint32_t num_rules;
+    uint32_t start_var;       // Variable id of the start symbol, or NO_START_SYMBOL
+    uint32_t symbols_offset;
+    uint32_t terminals_offset;
+    uint32_t pairs_offset;
+    uint32_t rules_offset;
+    uint64_t fingerprint;     // Hash of the sorted rule set + start symbol
+    uint64_t checksum;        // FNV-1a over every byte after the header
+};
+
+// FNV-1a, 64 bit. Used both for the checksum and the grammar fingerprint.
+uint64_t fnv1a(const void* data, size_t len, uint64_t hash = 1469598103934665603ULL) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
 class CNFGrammar {
 private:
@@ -17,8 +78,10 @@ private:
     bool is_cnf_compliant = true;
     std::string start_symbol;
 
-    bool isVariable(char c) { return std::isupper(c); }
-    bool isTerminal(char c) { return std::islower(c); }
+    friend class CNFGenerator;
+
+    bool isVariable(char c) const { return std::isupper(c); }
+    bool isTerminal(char c) const { return std::islower(c); }
 
 public:
     void setStartSymbol(const std::string& s) {
@@ -129,30 +192,412 @@ public:
         }
         return false;
     }
+
+    // Fingerprint of the language definition: independent of the order in
+    // which rules were added, so two builds of the same grammar match.
+    uint64_t fingerprint() const {
+        std::vector<std::string> canonical;
+        for (const auto& r : rules_list) canonical.push_back(r.head + "->" + r.body);
+        std::sort(canonical.begin(), canonical.end());
+        canonical.erase(std::unique(canonical.begin(), canonical.end()), canonical.end());
+
+        uint64_t hash = fnv1a(start_symbol.data(), start_symbol.size());
+        for (const auto& c : canonical) {
+            hash = fnv1a(c.data(), c.size(), hash);
+            hash = fnv1a("\n", 1, hash);
+        }
+        return hash;
+    }
+
+    // Writes the grammar as a compiled image (see CompiledHeader above).
+    bool saveCompiled(const std::string& path) const {
+        if (!is_cnf_compliant) {
+            std::cerr << "Error: Cannot compile. Grammar must be in strict CNF." << std::endl;
+            return false;
+        }
+
+        // Symbol table: variables sorted by character, so ids are stable.
+        std::string vars;
+        for (const auto& r : rules_list) {
+            if (vars.find(r.head[0]) == std::string::npos) vars += r.head[0];
+            for (char c : r.body) {
+                if (isVariable(c) && vars.find(c) == std::string::npos) vars += c;
+            }
+        }
+        std::sort(vars.begin(), vars.end());
+        auto varId = [&vars](char c) { return static_cast<uint32_t>(vars.find(c)); };
+
+        CompiledHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+        header.version = COMPILED_VERSION;
+        header.endian_tag = COMPILED_ENDIAN_TAG;
+        header.header_size = sizeof(CompiledHeader);
+        header.num_vars = vars.size();
+        header.num_rules = rules_list.size();
+        header.start_var = (start_symbol.length() == 1 && vars.find(start_symbol[0]) != std::string::npos)
+                               ? varId(start_symbol[0]) : NO_START_SYMBOL;
+
+        // Sections are 4-byte aligned so the uint32 tables can be read in place.
+        auto align4 = [](uint32_t x) { return (x + 3u) & ~3u; };
+        header.symbols_offset = header.header_size;
+        header.terminals_offset = align4(header.symbols_offset + header.num_vars);
+        header.pairs_offset = header.terminals_offset + 256 * sizeof(uint32_t);
+        header.rules_offset = header.pairs_offset + header.num_vars * header.num_vars * sizeof(uint32_t);
+        header.file_size = header.rules_offset + header.num_rules * 4;
+        header.fingerprint = fingerprint();
+
+        std::vector<char> image(header.file_size, 0);
+        std::memcpy(&image[header.symbols_offset], vars.data(), vars.size());
+
+        uint32_t* terminals = reinterpret_cast<uint32_t*>(&image[header.terminals_offset]);
+        uint32_t* pairs = reinterpret_cast<uint32_t*>(&image[header.pairs_offset]);
+        char* rules = &image[header.rules_offset];
+
+        for (const auto& r : rules_list) {
+            uint32_t headBit = 1u << varId(r.head[0]);
+            if (r.body.length() == 1) {
+                terminals[static_cast<unsigned char>(r.body[0])] |= headBit;
+            } else {
+                pairs[varId(r.body[0]) * header.num_vars + varId(r.body[1])] |= headBit;
+            }
+            rules[0] = r.head[0];
+            rules[1] = r.body[0];
+            rules[2] = r.body.length() > 1 ? r.body[1] : 0;
+            rules[3] = static_cast<char>(r.body.length());
+            rules += 4;
+        }
+
+        header.checksum = fnv1a(&image[header.header_size], header.file_size - header.header_size);
+        std::memcpy(&image[0], &header, sizeof(header));
+
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out.write(&image[0], image.size())) {
+            std::cerr << "Error: Could not write compiled grammar to " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
 };
 
-int main() {
-    std::cout << "--- CNF Simulator with CYK Parser ---" << std::endl;
-    std::cout << "Demonstrating a Hash-Map based implementation for efficiency." << std::endl;
-    
-    // --- Example 1: { a^n b^n } in CNF ---
-    // Original CFG: S -> aSb | ab
-    // CNF Conversion:
-    // S -> AB | AC
-    // C -> SB
-    // A -> a
-    // B -> b
-    
-    CNFGrammar grammar;
-    grammar.setStartSymbol("S");
-    grammar.addRule("S", "AB");
-    grammar.addRule("S", "AC");
-    grammar.addRule("C", "SB");
-    grammar.addRule("A", "a");
-    grammar.addRule("B", "b");
+// Read-only view of a compiled grammar image. The file is memory-mapped and
+// the parser reads the bitmask tables in place; nothing is deserialized.
+class CompiledCNFGrammar {
+private:
+    MappedFile file;
+    const char* data = nullptr;
+    size_t size = 0;
 
-    grammar.printGrammar();
+    const CompiledHeader* header() const { return reinterpret_cast<const CompiledHeader*>(data); }
+    const uint32_t* terminals() const { return reinterpret_cast<const uint32_t*>(data + header()->terminals_offset); }
+    const uint32_t* pairs() const { return reinterpret_cast<const uint32_t*>(data + header()->pairs_offset); }
+
+    void unmap() {
+        file.close();
+        data = nullptr;
+        size = 0;
+    }
+
+    bool fail(const std::string& path, const char* reason) {
+        std::cerr << "Error: " << path << ": " << reason << std::endl;
+        unmap();
+        return false;
+    }
+
+public:
+    CompiledCNFGrammar() {}
+    CompiledCNFGrammar(const CompiledCNFGrammar&) = delete;
+    CompiledCNFGrammar& operator=(const CompiledCNFGrammar&) = delete;
 
+    bool load(const std::string& path) {
+        unmap();
+        if (!file.open(path)) return fail(path, file.error());
+        data = file.data();
+        size = file.size();
+        // Validate before trusting any offset in the header.
+        if (size < sizeof(CompiledHeader)) return fail(path, "truncated header");
+        const CompiledHeader* h = header();
+        if (std::memcmp(h->magic, COMPILED_MAGIC, sizeof(h->magic)) != 0) return fail(path, "not a compiled CNF grammar");
+        if (h->endian_tag != COMPILED_ENDIAN_TAG) return fail(path, "written with a different byte order");
+        if (h->version != COMPILED_VERSION) return fail(path, "unsupported format version");
+        if (h->header_size != sizeof(CompiledHeader) || h->file_size != size || h->num_vars > 32 ||
+            (h->start_var != NO_START_SYMBOL && h->start_var >= h->num_vars)) {
+            return fail(path, "corrupt header");
+        }
+        if (h->symbols_offset != h->header_size ||
+            static_cast<uint64_t>(h->symbols_offset) + h->num_vars > h->terminals_offset ||
+            h->terminals_offset % 4 != 0 || h->pairs_offset % 4 != 0 ||
+            static_cast<uint64_t>(h->terminals_offset) + 256 * sizeof(uint32_t) > h->pairs_offset ||
+            h->rules_offset + static_cast<uint64_t>(h->num_rules) * 4 != h->file_size ||
+            h->pairs_offset + static_cast<uint64_t>(h->num_vars) * h->num_vars * 4 != h->rules_offset) {
+            return fail(path, "corrupt section table");
+        }
+        if (fnv1a(data + h->header_size, size - h->header_size) != h->checksum) return fail(path, "checksum mismatch");
+        const char* r = data + h->rules_offset;
+        for (uint32_t i = 0; i < h->num_rules; i++, r += 4) {
+            if (r[3] != 1 && r[3] != 2) return fail(path, "corrupt rule list");
+        }
+        return true;
+    }
+
+    uint64_t fingerprint() const { return header()->fingerprint; }
+
+    void printGrammar() const {
+        const CompiledHeader* h = header();
+        std::cout << "Grammar Rules (compiled image, fingerprint " << std::hex << h->fingerprint << std::dec << "):" << std::endl;
+        const char* r = data + h->rules_offset;
+        for (uint32_t i = 0; i < h->num_rules; i++, r += 4) {
+            std::cout << "  " << r[0] << " -> " << std::string(r + 1, static_cast<size_t>(r[3])) << std::endl;
+        }
+    }
+
+    // CYK over bitmasks: each cell is the set of variables deriving that
+    // substring, and A -> BC lookups are a single table read.
+    bool parse(const std::string& input) const {
+        const CompiledHeader* h = header();
+        if (input.empty() || h->start_var == NO_START_SYMBOL) return false;
+
+        const uint32_t nv = h->num_vars;
+        const uint32_t* term = terminals();
+        const uint32_t* pair = pairs();
+        const int n = input.length();
+
+        // table[(len - 1) * n + i] = variables deriving input[i, i + len)
+        std::vector<uint32_t> table(static_cast<size_t>(n) * n, 0);
+        for (int i = 0; i < n; i++) {
+            table[i] = term[static_cast<unsigned char>(input[i])];
+        }
+
+        for (int len = 2; len <= n; len++) {
+            for (int i = 0; i <= n - len; i++) {
+                uint32_t cell = 0;
+                for (int k = 1; k < len; k++) {
+                    uint32_t left = table[(k - 1) * n + i];
+                    uint32_t right = table[(len - k - 1) * n + i + k];
+                    if (!left || !right) continue;
+
+                    for (uint32_t B = 0; B < nv; B++) {
+                        if (!(left & (1u << B))) continue;
+                        const uint32_t* row = pair + B * nv;
+                        for (uint32_t C = 0; C < nv; C++) {
+                            if (right & (1u << C)) cell |= row[C];
+                        }
+                    }
+                }
+                table[(len - 1) * n + i] = cell;
+            }
+        }
+
+        return (table[(n - 1) * n] >> h->start_var) & 1u;
+    }
+};
+
+// ==========================================
+// String Generation (Sampling & Enumeration)
+// ==========================================
+// Builds corpora of valid strings of an exact length for load-testing the
+// CYK parser. count[A][n] is the number of derivation trees of A that yield a
+// string of length n:
+//   count[A][1] = #{ A -> a }
+//   count[A][n] = sum over A -> BC, 0 < k < n of count[B][k] * count[C][n - k]
+// Sampling walks the same recurrence top-down, picking each rule/split with
+// probability proportional to its count, so every derivation tree of the
+// requested length is equally likely (= uniform over strings when the grammar
+// is unambiguous; ambiguous strings are weighted by their number of trees).
+// Counts are doubles, so they stay finite for lengths in the hundreds; past
+// that, or for a grammar that is not strict CNF, error() says why nothing
+// can be generated.
+class CNFGenerator {
+private:
+    struct Binary { int left, right; };
+    struct Choice {
+        double cumulative;   // Running total of weights, for binary search
+        int rule;            // Index into binary[A], or -1 for a terminal rule
+        int split;           // Length of the left part (k), or the terminal char
+    };
+    struct Goal { int var; int len; int pos; };
+
+    std::vector<char> varChars;               // id -> variable character
+    std::vector<std::vector<Binary>> binary;  // A -> BC rules, per head
+    std::vector<std::string> terminal;        // A -> a rules, per head
+    int start = -1;
+    int maxLen = 0;
+    std::string failure;  // Non-empty: the generator can't be used
+
+    std::vector<std::vector<double>> count;                 // count[A][n]
+    std::vector<std::vector<std::vector<Choice>>> choices;  // choices[A][n]
+
+    std::mt19937_64 rng;
+    std::vector<Goal> work;
+    std::string buffer;
+
+    // Emits every string of the pending goals; 'work' is used as the stack.
+    template <typename Fn>
+    void enumerateGoals(Fn& emit, uint64_t& produced) {
+        if (work.empty()) {
+            emit(static_cast<const std::string&>(buffer));
+            produced++;
+            return;
+        }
+        Goal g = work.back();
+        work.pop_back();
+        for (const auto& c : choices[g.var][g.len]) {
+            if (c.rule < 0) {
+                buffer[g.pos] = static_cast<char>(c.split);
+                enumerateGoals(emit, produced);
+            } else {
+                const Binary& r = binary[g.var][c.rule];
+                work.push_back({r.right, g.len - c.split, g.pos + c.split});
+                work.push_back({r.left, c.split, g.pos});
+                enumerateGoals(emit, produced);
+                work.pop_back();
+                work.pop_back();
+            }
+        }
+        work.push_back(g);
+    }
+
+public:
+    CNFGenerator(const CNFGrammar& grammar, int maxLength, uint64_t seed = 5489u)
+        : maxLen(maxLength), rng(seed) {
+        if (!grammar.is_cnf_compliant) {
+            failure = "Grammar must be in strict CNF.";
+            return;
+        }
+        auto idOf = [this](char c) {
+            for (size_t i = 0; i < varChars.size(); i++) if (varChars[i] == c) return static_cast<int>(i);
+            varChars.push_back(c);
+            binary.emplace_back();
+            terminal.emplace_back();
+            return static_cast<int>(varChars.size() - 1);
+        };
+
+        for (const auto& r : grammar.rules_list) {
+            int head = idOf(r.head[0]);
+            if (r.body.length() == 1) {
+                terminal[head] += r.body[0];
+            } else {
+                int left = idOf(r.body[0]);
+                int right = idOf(r.body[1]);
+                binary[head].push_back({left, right});
+            }
+        }
+        if (grammar.start_symbol.length() == 1) start = idOf(grammar.start_symbol[0]);
+
+        // Bottom-up counts, then the per-(A, n) choice tables.
+        const size_t nv = varChars.size();
+        count.assign(nv, std::vector<double>(maxLen + 1, 0.0));
+        choices.assign(nv, std::vector<std::vector<Choice>>(maxLen + 1));
+        for (int n = 1; n <= maxLen; n++) {
+            for (size_t A = 0; A < nv; A++) {
+                double total = 0;
+                if (n == 1) {
+                    for (char a : terminal[A]) {
+                        total += 1;
+                        choices[A][n].push_back({total, -1, static_cast<unsigned char>(a)});
+                    }
+                }
+                for (size_t r = 0; r < binary[A].size(); r++) {
+                    for (int k = 1; k < n; k++) {
+                        double w = count[binary[A][r].left][k] * count[binary[A][r].right][n - k];
+                        if (w == 0) continue;
+                        total += w;
+                        choices[A][n].push_back({total, static_cast<int>(r), k});
+                    }
+                }
+                if (!std::isfinite(total)) {
+                    failure = "More derivations of length " + std::to_string(n) +
+                              " than a double can count; use a shorter length.";
+                    return;
+                }
+                count[A][n] = total;
+            }
+        }
+    }
+
+    // Why the generator can't be used, or empty if it can.
+    const std::string& error() const { return failure; }
+
+    // Number of derivation trees of the start symbol with yield length n.
+    double derivations(int n) const {
+        if (!failure.empty() || start < 0 || n < 1 || n > maxLen) return 0;
+        return count[start][n];
+    }
+
+    // Draws one string of length n (n <= maxLength). Returns false if the
+    // grammar derives no string of that length.
+    bool sample(int n, std::string& out) {
+        if (derivations(n) == 0) return false;
+        out.resize(n);
+        work.clear();
+        work.push_back({start, n, 0});
+
+        // Children write disjoint ranges of 'out', so goal order does not matter.
+        while (!work.empty()) {
+            Goal g = work.back();
+            work.pop_back();
+            const std::vector<Choice>& options = choices[g.var][g.len];
+            auto it = options.begin();
+            if (options.size() > 1) {
+                // 53 random bits -> [0, 1), cheaper than uniform_real_distribution
+                double r = (rng() >> 11) * (1.0 / 9007199254740992.0) * options.back().cumulative;
+                it = std::upper_bound(options.begin(), options.end(), r,
+                                      [](double v, const Choice& c) { return v < c.cumulative; });
+                if (it == options.end()) --it;
+            }
+
+            if (it->rule < 0) {
+                out[g.pos] = static_cast<char>(it->split);
+            } else {
+                const Binary& rule = binary[g.var][it->rule];
+                work.push_back({rule.left, it->split, g.pos});
+                work.push_back({rule.right, g.len - it->split, g.pos + it->split});
+            }
+        }
+        return true;
+    }
+
+    // Calls emit(const std::string&) once per derivation tree of length n and
+    // returns how many strings were emitted. A string with several trees
+    // (ambiguous grammars) is emitted once per tree. Only choices with a
+    // non-zero count are followed, so the search never hits a dead end.
+    template <typename Fn>
+    uint64_t enumerate(int n, Fn emit) {
+        uint64_t produced = 0;
+        if (derivations(n) == 0) return produced;
+        buffer.assign(n, '?');
+        work.clear();
+        work.push_back({start, n, 0});
+        enumerateGoals(emit, produced);
+        return produced;
+    }
+};
+
+// Loads a text grammar file (format in Common/GrammarReader.h). Symbols are
+// single characters in CNFGrammar, so a body's symbols are joined into one
+// string ("A B" -> "AB"). The first head becomes the start symbol.
+bool loadGrammar(const std::string& path, CNFGrammar& grammar) {
+    GrammarReader reader;
+    if (!reader.open(path)) return false;
+    std::string head, body; // Reused for every rule
+    bool first = true;
+    bool ok = reader.read([&](const GrammarToken& h, const GrammarToken* syms, size_t n) {
+        head.assign(h.text, h.length);
+        body.clear();
+        for (size_t i = 0; i < n; i++) body.append(syms[i].text, syms[i].length);
+        if (first) grammar.setStartSymbol(head);
+        first = false;
+        grammar.addRule(head, body);
+    });
+    if (!ok) return false;
+    reader.report(std::cerr);
+    return true;
+}
+
+// Runs the fixed test strings and then the interactive prompt against any
+// grammar object with a parse(std::string) method.
+template <typename G>
+void runTests(G& grammar) {
     std::cout << "\n--- Testing Strings ---" << std::endl;
     std::vector<std::string> tests = {
         "ab",
@@ -177,6 +622,115 @@ int main() {
         std::cout << "Result: " << (result ? "ACCEPTED" : "REJECTED") << std::endl;
         std::cout << "Enter next string: ";
     }
+}
+
+// Usage:
+//   CNF_Example                   run the demo with the in-memory grammar
+//   CNF_Example --compile <file>  write the demo grammar as a compiled image
+//   CNF_Example --load <file>     map a compiled image and parse with it
+//   CNF_Example --sample <len> <count> [seed]
+//                                 print <count> uniformly random strings of length <len>
+//   CNF_Example --enumerate <len> print the string of every derivation tree of length <len>
+//                                 (an ambiguous grammar repeats strings)
+// Any mode can be preceded by --grammar <file> to use a grammar file instead
+// of the built-in one.
+int main(int argc, char* argv[]) {
+    const char* program = argv[0];
+    std::string grammarFile;
+    if (argc > 2 && std::string(argv[1]) == "--grammar") {
+        grammarFile = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (((mode == "--compile" || mode == "--load" || mode == "--enumerate") && argc < 3) ||
+        (mode == "--sample" && argc < 4)) {
+        std::cerr << "Usage: " << program << " [--grammar <file>] [--compile <file> | --load <file> | "
+                  << "--sample <len> <count> [seed] | --enumerate <len>]" << std::endl;
+        return 1;
+    }
+
+    if (mode == "--load") {
+        CompiledCNFGrammar compiled;
+        if (!compiled.load(argv[2])) return 1;
+        compiled.printGrammar();
+        runTests(compiled);
+        return 0;
+    }
+
+    // --- Example 1: { a^n b^n } in CNF ---
+    // Original CFG: S -> aSb | ab
+    // CNF Conversion:
+    // S -> AB | AC
+    // C -> SB
+    // A -> a
+    // B -> b
+    
+    CNFGrammar grammar;
+    if (!grammarFile.empty()) {
+        if (!loadGrammar(grammarFile, grammar)) return 1;
+    } else {
+        grammar.setStartSymbol("S");
+        grammar.addRule("S", "AB");
+        grammar.addRule("S", "AC");
+        grammar.addRule("C", "SB");
+        grammar.addRule("A", "a");
+        grammar.addRule("B", "b");
+    }
+
+    if (mode == "--sample" || mode == "--enumerate") {
+        // Strings go to stdout in large blocks; the rate report goes to stderr
+        // so the output can be piped straight into a corpus file.
+        int len = std::atoi(argv[2]);
+        if (len < 1) {
+            std::cerr << "Error: string length must be a positive integer, got '" << argv[2] << "'" << std::endl;
+            return 1;
+        }
+        CNFGenerator generator(grammar, len, argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 5489u);
+        if (!generator.error().empty()) {
+            std::cerr << "Error: Cannot " << (mode == "--sample" ? "sample" : "enumerate") << ". "
+                      << generator.error() << std::endl;
+            return 1;
+        }
+        std::string block;
+        auto flush = [&block]() { std::fwrite(block.data(), 1, block.size(), stdout); block.clear(); };
+        auto emit = [&](const std::string& s) {
+            block += s;
+            block += '\n';
+            if (block.size() >= (1 << 20)) flush();
+        };
+
+        auto begin = std::chrono::steady_clock::now();
+        uint64_t produced = 0;
+        if (mode == "--sample") {
+            uint64_t wanted = std::strtoull(argv[3], nullptr, 10);
+            std::string s;
+            for (; produced < wanted && generator.sample(len, s); produced++) emit(s);
+        } else {
+            produced = generator.enumerate(len, emit);
+        }
+        flush();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::cerr << produced << " strings of length " << len << " in " << seconds << " s ("
+                  << (seconds > 0 ? produced / seconds : 0) << " strings/s, "
+                  << generator.derivations(len) << " derivations of this length)" << std::endl;
+        return 0;
+    }
+
+    std::cout << "--- CNF Simulator with CYK Parser ---" << std::endl;
+    std::cout << "Demonstrating a Hash-Map based implementation for efficiency." << std::endl;
+
+    grammar.printGrammar();
+
+    if (mode == "--compile") {
+        if (!grammar.saveCompiled(argv[2])) return 1;
+        std::cout << "Compiled grammar written to " << argv[2] << std::endl;
+        return 0;
+    }
+
+    runTests(grammar);
 
     return 0;
 }
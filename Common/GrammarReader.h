@@ -0,0 +1,238 @@
+/**
+ * GrammarReader.h
+ *
+ * Text grammar files, shared by the CNF and GNF simulations.
+ *
+ * One rule group per line; a line starting with '|' adds more bodies to the
+ * previous head:
+ *
+ *     S  -> A B | A C       # comment
+ *     C  -> S B
+ *        |  epsilon
+ *
+ * Symbols are separated by whitespace. A symbol starting with an upper-case
+ * letter is a variable, anything else is a terminal, and "epsilon" (or "ε")
+ * alone is the empty body. '|' always separates bodies and '#' at the start
+ * of a symbol starts a comment.
+ *
+ * The file is memory-mapped and tokens are (pointer, length) views into the
+ * mapping, so reading allocates nothing per token; callers intern each
+ * distinct token once through a TokenMap.
+ */
+
+#ifndef GRAMMAR_READER_H
+#define GRAMMAR_READER_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file: a memory mapping, or a heap copy where
+// mmap is unavailable.
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::vector<char> fallback;
+    const char* reason = "";
+
+    bool fail(const char* why) {
+        close();
+        reason = why;
+        return false;
+    }
+
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // On failure, error() says why.
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if (!in) return fail("cannot open file");
+        fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (fallback.empty()) return fail("empty or unreadable file");
+        bytes = fallback.data();
+        length = fallback.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return fail("cannot open file");
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return fail("empty or unreadable file");
+        }
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return fail("mmap failed");
+        bytes = static_cast<const char*>(mapped);
+        length = st.st_size;
+#endif
+        return true;
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (bytes && fallback.empty()) munmap(const_cast<char*>(bytes), length);
+#endif
+        fallback.clear();
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+    const char* error() const { return reason; }
+};
+
+// A symbol as it appears in the file. Valid while the reader is open.
+struct GrammarToken {
+    const char* text;
+    uint32_t length;
+
+    bool isVariable() const { return std::isupper(static_cast<unsigned char>(text[0])) != 0; }
+    bool isEpsilon() const {
+        return (length == 7 && std::memcmp(text, "epsilon", 7) == 0) ||
+               (length == 2 && std::memcmp(text, "\xCE\xB5", 2) == 0);
+    }
+    bool is(const char* word) const { return std::strlen(word) == length && std::memcmp(text, word, length) == 0; }
+    std::string str() const { return std::string(text, length); }
+
+    bool operator==(const GrammarToken& other) const {
+        return length == other.length && std::memcmp(text, other.text, length) == 0;
+    }
+};
+
+struct GrammarTokenHash {
+    size_t operator()(const GrammarToken& t) const {
+        uint64_t h = 14695981039346656037ull; // FNV-1a
+        for (uint32_t i = 0; i < t.length; i++) {
+            h ^= static_cast<unsigned char>(t.text[i]);
+            h *= 1099511628211ull;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
+// Token-keyed table, for interning each distinct symbol once per file.
+template <typename V>
+using TokenMap = std::unordered_map<GrammarToken, V, GrammarTokenHash>;
+
+class GrammarReader {
+private:
+    MappedFile file;
+    std::string path;
+    size_t ruleCount = 0;
+    double seconds = 0;
+
+    bool syntaxError(size_t line, const char* message) const {
+        std::cerr << "Error: " << path << ":" << line << ": " << message << std::endl;
+        return false;
+    }
+
+    static bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+public:
+    bool open(const std::string& filePath) {
+        path = filePath;
+        ruleCount = 0;
+        seconds = 0;
+        if (!file.open(path)) {
+            std::cerr << "Error: " << path << ": " << file.error() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Calls onRule(head, body, bodyLength) for every body in file order; an
+    // empty body has length 0. 'body' is reused between calls. Returns false
+    // at the first syntax error, after reporting it with its line number.
+    template <typename OnRule>
+    bool read(OnRule onRule) {
+        auto begin = std::chrono::steady_clock::now();
+        const char* p = file.data();
+        const char* end = p + file.size();
+        std::vector<GrammarToken> tokens;
+        GrammarToken head = {nullptr, 0};
+
+        for (size_t line = 1; p < end; line++) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!eol) eol = end;
+
+            // Split the line into tokens, '|' and a leading '#' ending them.
+            tokens.clear();
+            for (const char* q = p; q < eol;) {
+                if (isBlank(*q)) { q++; continue; }
+                if (*q == '#') break;
+                const char* start = q;
+                if (*q == '|') {
+                    q++;
+                } else {
+                    while (q < eol && !isBlank(*q) && *q != '|') q++;
+                }
+                tokens.push_back(GrammarToken{start, static_cast<uint32_t>(q - start)});
+            }
+            p = eol + 1;
+            if (tokens.empty()) continue;
+
+            size_t at;
+            if (tokens.size() >= 2 && tokens[1].is("->")) {
+                head = tokens[0];
+                if (!head.isVariable()) return syntaxError(line, "rule head must be a variable");
+                at = 2;
+            } else if (tokens[0].is("|") && head.text) {
+                at = 1; // Continues the previous head
+            } else {
+                return syntaxError(line, "expected 'Head -> body | body ...'");
+            }
+
+            // Emit each alternative; tokens are compacted in place to the front.
+            size_t count = 0;
+            for (size_t i = at; i <= tokens.size(); i++) {
+                if (i < tokens.size() && !tokens[i].is("|")) {
+                    tokens[count++] = tokens[i];
+                    continue;
+                }
+                if (count == 0) return syntaxError(line, "empty alternative (write epsilon for the empty body)");
+                if (count == 1 && tokens[0].isEpsilon()) count = 0;
+                for (size_t k = 0; k < count; k++) {
+                    if (tokens[k].isEpsilon()) return syntaxError(line, "epsilon must stand alone");
+                }
+                onRule(head, tokens.data(), count);
+                ruleCount++;
+                count = 0;
+            }
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        return true;
+    }
+
+    size_t rules() const { return ruleCount; }
+    double elapsed() const { return seconds; }
+
+    void report(std::ostream& out) const {
+        out << "Loaded " << ruleCount << " rules from " << path << " in " << seconds << " s ("
+            << (seconds > 0 ? ruleCount / seconds : 0) << " rules/s)" << std::endl;
+    }
+};
+
+#endif // GRAMMAR_READER_H
@@ -11,282 +11,3319 @@
 #include <string>
 #include <map>
 #include <set>
-#include <list>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <algorithm>
 #include <sstream>
 #include <iterator>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <initializer_list>
+#include <chrono>
+#include <fstream>
+#include <random>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "../Common/GrammarReader.h"
+
+// ==========================================
+// Core Data Structures
+// ==========================================
+
+enum SymbolType {
+    TERMINAL,
+    VARIABLE
+};
+
+// Represents Terminals and Variables as an interned 32-bit id.
+// The low bits index the SymbolTable (name + A_i ordering index); the top bit
+// marks variables, so type checks, comparisons, hashing and copies are all
+// plain integer operations. Variables sort after terminals, as before.
+struct Symbol {
+    static const uint32_t VARIABLE_BIT = 0x80000000u;
+    static const uint32_t INDEX_MASK = 0x7FFFFFFFu;
+
+    uint32_t id;
+
+    SymbolType type() const { return (id & VARIABLE_BIT) ? VARIABLE : TERMINAL; }
+    uint32_t slot() const { return id & INDEX_MASK; }
+
+    // Comparison for std::map and std::set keys
+    bool operator<(const Symbol& other) const { return id < other.id; }
+    bool operator==(const Symbol& other) const { return id == other.id; }
+    bool operator!=(const Symbol& other) const { return id != other.id; }
+
+    const std::string& name() const;
+    int index() const; // Used for the A_i ordering constraint.
+    bool isFresh() const; // Created by the converter rather than the user
+
+    std::string toString() const {
+        return name();
+    }
+};
+
+namespace std {
+template <>
+struct hash<Symbol> {
+    size_t operator()(const Symbol& s) const { return std::hash<uint32_t>()(s.id); }
+};
+}
+
+// Name table behind Symbol ids. Interning the same (name, type) twice returns
+// the same id, so symbols can be compared without touching their names.
+// fresh() allocates converter-generated variables: always a new dense id,
+// under a name no other symbol uses. Fresh variables are not visible to
+// intern(); a user name that one of them already has goes to the user
+// symbol, and the fresh variable is renamed.
+class SymbolTable {
+private:
+    std::vector<std::string> names;
+    std::vector<int> indices;
+    std::vector<char> generated;
+    std::unordered_map<std::string, uint32_t> lookup[2]; // User symbols, one per SymbolType
+    std::unordered_map<std::string, uint32_t> freshNames;
+    std::unordered_map<std::string, uint32_t> suffixes;  // Next "_n" to try, per fresh() base
+
+    Symbol add(const std::string& name, SymbolType type, int index, bool isFresh) {
+        uint32_t id = static_cast<uint32_t>(names.size());
+        if (type == VARIABLE) id |= Symbol::VARIABLE_BIT;
+        names.push_back(name);
+        indices.push_back(index);
+        generated.push_back(isFresh);
+        (isFresh ? freshNames : lookup[type]).emplace(name, id);
+        return Symbol{id};
+    }
+
+    bool taken(const std::string& name) const {
+        return lookup[TERMINAL].count(name) || lookup[VARIABLE].count(name) || freshNames.count(name);
+    }
+
+    // base if unused, else the first unused base_2, base_3, ...
+    std::string unusedName(const std::string& base) {
+        if (!taken(base)) return base;
+        uint32_t& next = suffixes[base];
+        if (next < 2) next = 2;
+        std::string name;
+        do {
+            name = base + "_" + std::to_string(next++);
+        } while (taken(name));
+        return name;
+    }
+
+public:
+    Symbol intern(const std::string& name, SymbolType type, int index = 0) {
+        auto found = lookup[type].find(name);
+        if (found != lookup[type].end()) return Symbol{found->second};
+        Symbol s = add(name, type, index, false);
+        auto clash = freshNames.find(name);
+        if (clash != freshNames.end()) {
+            uint32_t id = clash->second;
+            freshNames.erase(clash);
+            std::string renamed = unusedName(name);
+            names[id & Symbol::INDEX_MASK] = renamed;
+            freshNames.emplace(renamed, id);
+        }
+        return s;
+    }
+
+    // New variable named 'base', or base_2, base_3, ... if that name is
+    // already in use. Fresh variables carry no A_i index; they order after
+    // all user variables, by creation (see orderedBefore).
+    Symbol fresh(const std::string& base) {
+        return add(unusedName(base), VARIABLE, 0, true);
+    }
+
+    const std::string& name(Symbol s) const { return names[s.slot()]; }
+    int index(Symbol s) const { return indices[s.slot()]; }
+    void setIndex(Symbol s, int index) { indices[s.slot()] = index; }
+    bool isFresh(Symbol s) const { return generated[s.slot()] != 0; }
+};
+
+// Process-wide table shared by every grammar in the simulation.
+SymbolTable& symbols() {
+    static SymbolTable table;
+    return table;
+}
+
+const std::string& Symbol::name() const { return symbols().name(*this); }
+int Symbol::index() const { return symbols().index(*this); }
+bool Symbol::isFresh() const { return symbols().isFresh(*this); }
+
+// Variable ordering: user variables by A_i index (ties by id), then fresh
+// variables in creation order. Ids are dense and allocated in sequence, so
+// the id itself is the fresh variables' ordering key.
+bool orderedBefore(Symbol a, Symbol b) {
+    bool freshA = a.isFresh(), freshB = b.isFresh();
+    if (freshA != freshB) return freshB;
+    if (!freshA && a.index() != b.index()) return a.index() < b.index();
+    return a < b;
+}
+
+// Contiguous vector with N elements stored inline, for trivially copyable T.
+// Used as scratch space when building production bodies, so short prefixes
+// never touch the heap.
+template <typename T, uint32_t N>
+class SmallVector {
+private:
+    uint32_t count = 0;
+    uint32_t capacity = N;
+    union {
+        T local[N];
+        T* heap;
+    };
+
+    bool isInline() const { return capacity == N; }
+
+    void grow(uint32_t wanted) {
+        uint32_t newCapacity = std::max(wanted, capacity * 2);
+        T* block = static_cast<T*>(std::malloc(sizeof(T) * newCapacity));
+        std::memcpy(block, data(), sizeof(T) * count);
+        if (!isInline()) std::free(heap);
+        heap = block;
+        capacity = newCapacity;
+    }
+
+public:
+    typedef T value_type;
+    typedef const T* const_iterator;
+
+    SmallVector() {}
+    SmallVector(std::initializer_list<T> items) { append(items.begin(), items.end()); }
+    SmallVector(const T* first, const T* last) { append(first, last); }
+    SmallVector(const SmallVector& other) { append(other.begin(), other.end()); }
+    SmallVector(SmallVector&& other) : count(other.count), capacity(other.capacity) {
+        if (other.isInline()) {
+            std::memcpy(local, other.local, sizeof(T) * count);
+        } else {
+            heap = other.heap;
+            other.capacity = N;
+        }
+        other.count = 0;
+    }
+    ~SmallVector() {
+        if (!isInline()) std::free(heap);
+    }
+
+    SmallVector& operator=(SmallVector other) {
+        // Copy-and-swap through the move constructor
+        this->~SmallVector();
+        new (this) SmallVector(std::move(other));
+        return *this;
+    }
+
+    T* data() { return isInline() ? local : heap; }
+    const T* data() const { return isInline() ? local : heap; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& front() const { return data()[0]; }
+    const T& back() const { return data()[count - 1]; }
+
+    void reserve(size_t n) {
+        if (n > capacity) grow(static_cast<uint32_t>(n));
+    }
+
+    void clear() { count = 0; }
+
+    void push_back(const T& value) {
+        if (count == capacity) grow(count + 1);
+        data()[count++] = value;
+    }
+
+    void append(const T* first, const T* last) {
+        size_t n = last - first;
+        reserve(count + n);
+        std::memcpy(data() + count, first, sizeof(T) * n);
+        count += static_cast<uint32_t>(n);
+    }
+
+    bool operator<(const SmallVector& other) const {
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+    bool operator==(const SmallVector& other) const {
+        return count == other.count && std::equal(begin(), end(), other.begin());
+    }
+};
+
+// Production bodies are hash-consed persistent cons-lists: every suffix is an
+// immutable node shared by all bodies that end with it. Substituting
+// A -> beta into A alpha only allocates nodes for beta; alpha is reused as is,
+// so memory grows with the number of distinct suffixes, not total rule length.
+struct BodyNode {
+    Symbol head;
+    uint32_t length;        // Symbols from this node to the end of the body
+    const BodyNode* tail;   // nullptr terminates the list
+};
+
+// Owns every BodyNode and guarantees uniqueness: cons(s, t) returns the same
+// node for the same (s, t), so equal bodies are equal pointers.
+// consAll() takes a lock so parallel back substitution can share the store.
+class BodyStore {
+private:
+    std::deque<BodyNode> nodes;          // Stable addresses
+    std::vector<const BodyNode*> slots;  // Open-addressing unique table
+    std::mutex lock;
+    BodyStore* parent = nullptr;         // Scope stores: shared bodies come from here
+
+    // Full 64-bit mix: tails are 16-byte aligned and ids are dense, and
+    // without it they fill neighbouring slots and linear probing degrades.
+    static size_t hashOf(Symbol head, const BodyNode* tail) {
+        uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(tail)) ^ (head.id * 0x9E3779B97F4A7C15ULL);
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        return static_cast<size_t>(h ^ (h >> 33));
+    }
+
+    void rehash() {
+        std::vector<const BodyNode*> bigger(slots.empty() ? 1024 : slots.size() * 2, nullptr);
+        size_t mask = bigger.size() - 1;
+        for (const BodyNode& n : nodes) {
+            size_t i = hashOf(n.head, n.tail) & mask;
+            while (bigger[i]) i = (i + 1) & mask;
+            bigger[i] = &n;
+        }
+        slots.swap(bigger);
+    }
+
+    const BodyNode* find(Symbol head, const BodyNode* tail, size_t& slot) const {
+        if (slots.empty()) return nullptr;
+        size_t mask = slots.size() - 1;
+        for (slot = hashOf(head, tail) & mask; const BodyNode* n = slots[slot]; slot = (slot + 1) & mask) {
+            if (n->head == head && n->tail == tail) return n;
+        }
+        return nullptr;
+    }
+
+    const BodyNode* findShared(Symbol head, const BodyNode* tail) {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t slot;
+        return find(head, tail, slot);
+    }
+
+public:
+    BodyStore() {}
+    // A scope store: a body 'parent' already has is shared from it, a new
+    // one is consed here and freed with this store. A body found here is
+    // never looked up in 'parent' again, so each one keeps a single node
+    // for the scope's lifetime even while other threads cons into 'parent'.
+    explicit BodyStore(BodyStore* parentStore) : parent(parentStore) {}
+    BodyStore(const BodyStore&) = delete;
+    BodyStore& operator=(const BodyStore&) = delete;
+
+    const BodyNode* cons(Symbol head, const BodyNode* tail) {
+        size_t i = 0;
+        if (const BodyNode* n = find(head, tail, i)) return n;
+        if (parent) {
+            if (const BodyNode* shared = parent->findShared(head, tail)) return shared;
+        }
+        if (nodes.size() * 2 >= slots.size()) {
+            rehash();
+            find(head, tail, i);
+        }
+        nodes.push_back({head, tail ? tail->length + 1 : 1, tail});
+        slots[i] = &nodes.back();
+        return slots[i];
+    }
+
+    // Conses [first, last) in front of 'suffix' under one lock acquisition.
+    const BodyNode* consAll(const Symbol* first, const Symbol* last, const BodyNode* suffix) {
+        std::lock_guard<std::mutex> guard(lock);
+        while (last != first) suffix = cons(*--last, suffix);
+        return suffix;
+    }
+
+    size_t nodeCount() const { return nodes.size(); }
+    size_t bytes() const { return nodes.size() * sizeof(BodyNode) + slots.size() * sizeof(BodyNode*); }
+};
+
+BodyStore& bodyStore() {
+    static BodyStore store;
+    return store;
+}
+
+// The store this thread conses new bodies in: bodyStore() unless a
+// BodyScope is active.
+BodyStore*& currentBodyStore() {
+    static thread_local BodyStore* current = nullptr;
+    return current;
+}
+
+// Sends this thread's new bodies to 'store' (nullptr: bodyStore()) for the
+// lifetime of the scope.
+class BodyScope {
+private:
+    BodyStore* saved;
+
+public:
+    explicit BodyScope(BodyStore* store) : saved(currentBodyStore()) { currentBodyStore() = store; }
+    ~BodyScope() { currentBodyStore() = saved; }
+    BodyScope(const BodyScope&) = delete;
+    BodyScope& operator=(const BodyScope&) = delete;
+};
+
+// Handle to a hash-consed body. Copies are a single pointer, equality is
+// pointer equality, and ordering is lexicographic over the symbols (it stops
+// as soon as both sides reach the same shared suffix).
+class ProductionBody {
+private:
+    const BodyNode* node = nullptr;
+
+    explicit ProductionBody(const BodyNode* n) : node(n) {}
+
+    // Conses symbols [first, last) in front of 'suffix'.
+    static const BodyNode* build(const Symbol* first, const Symbol* last, const BodyNode* suffix) {
+        BodyStore* store = currentBodyStore();
+        return (store ? *store : bodyStore()).consAll(first, last, suffix);
+    }
+
+public:
+    class const_iterator {
+    private:
+        const BodyNode* at;
+    public:
+        explicit const_iterator(const BodyNode* n) : at(n) {}
+        const Symbol& operator*() const { return at->head; }
+        const Symbol* operator->() const { return &at->head; }
+        const_iterator& operator++() { at = at->tail; return *this; }
+        bool operator==(const const_iterator& o) const { return at == o.at; }
+        bool operator!=(const const_iterator& o) const { return at != o.at; }
+    };
+
+    ProductionBody() {}
+    ProductionBody(std::initializer_list<Symbol> items) : node(build(items.begin(), items.end(), nullptr)) {}
+    ProductionBody(const Symbol* first, const Symbol* last) : node(build(first, last, nullptr)) {}
+
+    // prefix ++ suffix. Only the prefix symbols are consed; suffix is shared.
+    static ProductionBody concat(const ProductionBody& prefix, const ProductionBody& suffix) {
+        if (!suffix.node) return prefix;
+        SmallVector<Symbol, 16> scratch;
+        for (Symbol s : prefix) scratch.push_back(s);
+        return ProductionBody(build(scratch.begin(), scratch.end(), suffix.node));
+    }
+
+    const_iterator begin() const { return const_iterator(node); }
+    const_iterator end() const { return const_iterator(nullptr); }
+    bool empty() const { return node == nullptr; }
+    size_t size() const { return node ? node->length : 0; }
+    const Symbol& front() const { return node->head; }
+    ProductionBody tail() const { return ProductionBody(node->tail); }
+    const BodyNode* id() const { return node; }
+
+    bool operator==(const ProductionBody& other) const { return node == other.node; }
+    bool operator!=(const ProductionBody& other) const { return node != other.node; }
+    bool operator<(const ProductionBody& other) const {
+        const BodyNode* x = node;
+        const BodyNode* y = other.node;
+        while (x != y) {
+            if (!x) return true;   // x is a proper prefix of y
+            if (!y) return false;
+            if (x->head != y->head) return x->head < y->head;
+            x = x->tail;
+            y = y->tail;
+        }
+        return false;
+    }
+};
+
+namespace std {
+template <>
+struct hash<ProductionBody> {
+    size_t operator()(const ProductionBody& b) const { return std::hash<const BodyNode*>()(b.id()); }
+};
+}
+
+// Use std::set to automatically filter duplicate rules and keep them sorted.
+using Productions = std::set<ProductionBody>;
+
+// Map Variables to their set of productions.
+using Grammar = std::map<Symbol, Productions>;
+
+// ==========================================
+// Helper Functions
+// ==========================================
+
+// Buffered grammar serializer. Output is assembled in one large reusable
+// buffer and handed to the FILE* in big blocks, instead of one stream
+// operation (and an endl flush) per symbol. Rules can be streamed one head
+// at a time: beginRule / addBody... / endRule.
+//
+// TEXT is the printGrammar layout:  A1 -> a A1 A3 | b A3
+// BINARY is a compact stream of records, after the 8-byte "GNFB" + version:
+//   1, varint key, varint name length, name bytes    symbol definition
+//   2, varint head key, varint body count,
+//      per body: varint length, varint keys           one head's rules
+// where key = (symbol slot << 1) | is-variable, and each symbol is defined
+// before its first use.
+class GrammarWriter {
+public:
+    enum Format { TEXT, BINARY };
+
+private:
+    FILE* out;
+    Format format;
+    std::string buffer;
+    size_t capacity;
+    std::vector<bool> defined;  // BINARY: symbols already defined, by slot
+    std::string ruleBodies;     // BINARY: bodies of the current rule
+    size_t bodyCount = 0;
+    Symbol currentHead = {0};
+
+    void putVarint(std::string& to, uint64_t v) {
+        while (v >= 0x80) {
+            to += static_cast<char>((v & 0x7F) | 0x80);
+            v >>= 7;
+        }
+        to += static_cast<char>(v);
+    }
+
+    static uint64_t keyOf(Symbol s) { return (static_cast<uint64_t>(s.slot()) << 1) | (s.type() == VARIABLE); }
+
+    void define(Symbol s) {
+        if (s.slot() >= defined.size()) defined.resize(s.slot() + 1, false);
+        if (defined[s.slot()]) return;
+        defined[s.slot()] = true;
+        const std::string& name = s.name();
+        buffer += '\x01';
+        putVarint(buffer, keyOf(s));
+        putVarint(buffer, name.size());
+        buffer += name;
+    }
+
+    void maybeFlush() {
+        if (buffer.size() >= capacity) flush();
+    }
+
+    template <typename It>
+    void addSymbols(It first, It last, size_t length) {
+        if (format == TEXT) {
+            buffer += bodyCount == 0 ? currentHead.name() + " -> " : std::string(" | ");
+            bool firstSym = true;
+            for (It at = first; at != last; ++at) {
+                // Add space between symbols for readability (e.g. "A2 A3" vs "A2A3")
+                if (!firstSym) buffer += ' ';
+                buffer += at->name();
+                firstSym = false;
+            }
+        } else {
+            putVarint(ruleBodies, length);
+            for (It at = first; at != last; ++at) {
+                define(*at);
+                putVarint(ruleBodies, keyOf(*at));
+            }
+        }
+        bodyCount++;
+    }
+
+public:
+    explicit GrammarWriter(FILE* stream, Format f = TEXT, size_t bufferBytes = 1 << 20)
+        : out(stream), format(f), capacity(bufferBytes) {
+        buffer.reserve(capacity + 4096);
+        if (format == BINARY) {
+            buffer.append("GNFB", 4);
+            uint32_t version = 1;
+            buffer.append(reinterpret_cast<const char*>(&version), sizeof(version));
+        }
+    }
+    GrammarWriter(const GrammarWriter&) = delete;
+    GrammarWriter& operator=(const GrammarWriter&) = delete;
+    ~GrammarWriter() { flush(); }
+
+    void flush() {
+        if (!buffer.empty()) std::fwrite(buffer.data(), 1, buffer.size(), out);
+        buffer.clear();
+        std::fflush(out);
+    }
+
+    // TEXT only: the "--- title ---" banner and closing rule of printGrammar.
+    void beginSection(const std::string& title) {
+        if (format == TEXT) buffer += "--- " + title + " ---\n";
+    }
+    void endSection() {
+        if (format == TEXT) buffer += "--------------------------------\n\n";
+        maybeFlush();
+    }
+
+    void beginRule(Symbol head) {
+        currentHead = head;
+        bodyCount = 0;
+        ruleBodies.clear();
+    }
+
+    void addBody(const ProductionBody& body) { addSymbols(body.begin(), body.end(), body.size()); }
+    void addBody(const Symbol* first, const Symbol* last) { addSymbols(first, last, last - first); }
+
+    // Heads without bodies are skipped, as printGrammar always did.
+    void endRule() {
+        if (bodyCount == 0) return;
+        if (format == TEXT) {
+            buffer += '\n';
+        } else {
+            define(currentHead);
+            buffer += '\x02';
+            putVarint(buffer, keyOf(currentHead));
+            putVarint(buffer, bodyCount);
+            buffer += ruleBodies;
+        }
+        maybeFlush();
+    }
+
+    void writeGrammar(const Grammar& G) {
+        for (const auto& pair : G) {
+            beginRule(pair.first);
+            for (const auto& body : pair.second) addBody(body);
+            endRule();
+        }
+    }
+};
+
+// Temporary on-disk store for production sets, so that GNFConverter can
+// drop finalized heads from memory during back substitution. Each head is
+// one record of 32-bit words, per body: length, symbol ids. Records are
+// written and read back in fixed-size chunks, so a head never has to fit
+// in memory twice. The file is unlinked as soon as it is created, so it
+// disappears with the process. put() appends under a lock; get() reads
+// with pread and may run on any number of threads at once.
+class SpillStore {
+private:
+    struct Record { uint64_t offset; uint64_t words; size_t bodies; };
+
+    static const size_t CHUNK_WORDS = 1 << 16;
+
+    FILE* file = nullptr;
+    uint64_t end = 0;
+    std::unordered_map<Symbol, Record> records;
+    mutable std::mutex lock;
+    size_t bodyCount = 0;
+
+    bool readAt(uint32_t* to, size_t words, uint64_t offset) const {
+        size_t bytes = words * sizeof(uint32_t);
+#ifdef _WIN32
+        std::lock_guard<std::mutex> guard(lock);
+        bool ok = std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0 && std::fread(to, 1, bytes, file) == bytes;
+        std::fseek(file, 0, SEEK_END);
+        if (ok) return true;
+#else
+        size_t done = 0;
+        while (done < bytes) {
+            ssize_t got = pread(fileno(file), reinterpret_cast<char*>(to) + done, bytes - done, offset + done);
+            if (got <= 0) break;
+            done += got;
+        }
+        if (done == bytes) return true;
+#endif
+        std::cerr << "Error: reading the spill file failed" << std::endl;
+        return false;
+    }
+
+public:
+    SpillStore() {}
+    SpillStore(const SpillStore&) = delete;
+    SpillStore& operator=(const SpillStore&) = delete;
+    ~SpillStore() { close(); }
+
+    // Creates the file in 'directory' (std::tmpfile's location on Windows).
+    bool open(const std::string& directory) {
+        close();
+#ifdef _WIN32
+        (void)directory;
+        file = std::tmpfile();
+#else
+        std::string path = directory + "/gnf-spill-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd >= 0) {
+            unlink(path.c_str());
+            file = fdopen(fd, "w+b");
+            if (!file) ::close(fd);
+        }
+#endif
+        if (!file) {
+            std::cerr << "Error: cannot create a spill file in " << directory << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (file) std::fclose(file);
+        file = nullptr;
+        end = 0;
+        records.clear();
+        bodyCount = 0;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    // Appends the record of 'head'; each(f) must call f(body) for every body.
+    template <typename Each>
+    bool put(Symbol head, Each each) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<uint32_t> chunk;
+        chunk.reserve(CHUNK_WORDS);
+        uint64_t words = 0;
+        size_t bodies = 0;
+        bool ok = true;
+        auto drain = [&]() {
+            ok = ok && std::fwrite(chunk.data(), sizeof(uint32_t), chunk.size(), file) == chunk.size();
+            words += chunk.size();
+            chunk.clear();
+        };
+        each([&](const ProductionBody& body) {
+            chunk.push_back(static_cast<uint32_t>(body.size()));
+            for (Symbol sym : body) chunk.push_back(sym.id);
+            bodies++;
+            if (chunk.size() >= CHUNK_WORDS) drain();
+        });
+        drain();
+        if (!ok || std::fflush(file) != 0) {
+            std::cerr << "Error: writing the spill file failed (disk full?)" << std::endl;
+            std::fseek(file, static_cast<long>(end), SEEK_SET);
+            return false;
+        }
+        records[head] = Record{end, words, bodies};
+        end += words * sizeof(uint32_t);
+        bodyCount += bodies;
+        return true;
+    }
+
+    // Calls f(first, last) with the symbols of every body spilled for
+    // 'head'; nothing is consed. Returns false if the head was never
+    // spilled or the file could not be read.
+    template <typename F>
+    bool get(Symbol head, F f) const {
+        Record record;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = records.find(head);
+            if (found == records.end()) return false;
+            record = found->second;
+        }
+        std::vector<uint32_t> buffer;
+        size_t at = 0;
+        uint64_t next = record.offset;
+        uint64_t left = record.words;
+        // Makes at least n words available from buffer[at].
+        auto ensure = [&](size_t n) {
+            if (buffer.size() - at >= n) return true;
+            buffer.erase(buffer.begin(), buffer.begin() + at);
+            at = 0;
+            size_t want = static_cast<size_t>(std::min<uint64_t>(left, std::max(n - buffer.size(), CHUNK_WORDS)));
+            size_t old = buffer.size();
+            buffer.resize(old + want);
+            if (!readAt(buffer.data() + old, want, next)) return false;
+            next += want * sizeof(uint32_t);
+            left -= want;
+            return buffer.size() >= n;
+        };
+
+        SmallVector<Symbol, 16> body;
+        for (uint64_t bodies = 0; bodies < record.bodies; bodies++) {
+            if (!ensure(1)) return false;
+            uint32_t length = buffer[at++];
+            if (!ensure(length)) return false;
+            body.clear();
+            for (uint32_t k = 0; k < length; k++) body.push_back(Symbol{buffer[at++]});
+            f(body.begin(), body.end());
+        }
+        return true;
+    }
+
+    size_t heads() const { std::lock_guard<std::mutex> guard(lock); return records.size(); }
+    size_t bodies() const { std::lock_guard<std::mutex> guard(lock); return bodyCount; }
+    size_t symbolCount() const { std::lock_guard<std::mutex> guard(lock); return end / sizeof(uint32_t) - bodyCount; }
+    uint64_t bytes() const { std::lock_guard<std::mutex> guard(lock); return end; }
+};
+
+const size_t SpillStore::CHUNK_WORDS;
+
+// Loads a text grammar file (format in Common/GrammarReader.h) into G.
+// Variables get A_i indices in order of first appearance in this file, so
+// the first head is A_1 (and the default start symbol); a name some earlier
+// grammar already interned is re-indexed. Each distinct token is interned
+// once; rules only look tokens up.
+bool loadGrammar(const std::string& path, Grammar& G) {
+    GrammarReader reader;
+    if (!reader.open(path)) return false;
+    TokenMap<Symbol> interned;
+    int variables = 0;
+    auto lookup = [&](const GrammarToken& t) {
+        auto found = interned.find(t);
+        if (found != interned.end()) return found->second;
+        Symbol s = t.isVariable() ? symbols().intern(t.str(), VARIABLE) : symbols().intern(t.str(), TERMINAL);
+        if (t.isVariable()) symbols().setIndex(s, ++variables);
+        interned.emplace(t, s);
+        return s;
+    };
+    SmallVector<Symbol, 16> body;
+    bool ok = reader.read([&](const GrammarToken& head, const GrammarToken* syms, size_t n) {
+        Symbol A = lookup(head);
+        body.clear();
+        for (size_t i = 0; i < n; i++) body.push_back(lookup(syms[i]));
+        G[A].insert(ProductionBody(body.begin(), body.end()));
+    });
+    if (!ok) return false;
+    reader.report(std::cerr);
+    return true;
+}
+
+void printGrammar(const Grammar& G, const std::string& stageName) {
+    std::cout.flush();
+    GrammarWriter writer(stdout);
+    writer.beginSection(stageName);
+    writer.writeGrammar(G);
+    writer.endSection();
+}
+
+// ==========================================
+// Instrumentation
+// ==========================================
+
+// Live and peak heap bytes, maintained by the global operator new/delete
+// replacements below once enable() has been called (by the converter, when
+// per-stage stats, a memory budget or a spill threshold need them); until
+// then an allocation costs one relaxed load more than malloc. Every
+// allocation carries a small header with its counted size (0 if it was made
+// while counting was off) so delete can subtract it.
+struct AllocationStats {
+    static std::atomic<size_t>& live() { static std::atomic<size_t> v(0); return v; }
+    static std::atomic<size_t>& peak() { static std::atomic<size_t> v(0); return v; }
+    static std::atomic<bool>& enabled() { static std::atomic<bool> v(false); return v; }
+
+    // Counts allocations from now on; live() excludes older ones.
+    static void enable() { enabled() = true; }
+
+    static void added(size_t n) {
+        size_t now = live() += n;
+        size_t seen = peak().load();
+        while (now > seen && !peak().compare_exchange_weak(seen, now)) {}
+    }
+    static void removed(size_t n) { live() -= n; }
+    // Starts a new measurement window: peak restarts from the current live size.
+    static void resetPeak() { peak() = live().load(); }
+};
+
+namespace {
+const size_t ALLOC_HEADER = 16; // Keeps the returned pointer max-aligned
+
+void* countedAlloc(size_t n) {
+    void* block = std::malloc(n + ALLOC_HEADER);
+    if (!block) throw std::bad_alloc();
+    bool counted = AllocationStats::enabled().load(std::memory_order_relaxed);
+    *static_cast<size_t*>(block) = counted ? n : 0;
+    if (counted) AllocationStats::added(n);
+    return static_cast<char*>(block) + ALLOC_HEADER;
+}
+
+void countedFree(void* p) {
+    if (!p) return;
+    void* block = static_cast<char*>(p) - ALLOC_HEADER;
+    size_t counted = *static_cast<size_t*>(block);
+    if (counted) AllocationStats::removed(counted);
+    std::free(block);
+}
+}
+
+void* operator new(size_t n) { return countedAlloc(n); }
+void* operator new[](size_t n) { return countedAlloc(n); }
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+
+// One line of the per-stage report, written as a JSON object per line.
+struct StageRecord {
+    std::string stage;
+    double seconds;
+    size_t variables;
+    size_t productions;
+    size_t symbols;      // Total body length
+    size_t peakBytes;    // Highest live heap size during the stage
+    size_t liveBytes;    // Live heap size when the stage ended
+
+    void writeJson(std::ostream& out) const {
+        out << "{\"stage\":\"" << stage << "\",\"seconds\":" << seconds
+            << ",\"variables\":" << variables << ",\"productions\":" << productions
+            << ",\"symbols\":" << symbols << ",\"peak_bytes\":" << peakBytes
+            << ",\"live_bytes\":" << liveBytes << "}\n";
+    }
+};
+
+// Conversion method used by GNFConverter::run().
+enum class GNFAlgorithm {
+    Substitution,   // Classic steps 2-5: ordering, forward and back substitution
+    LeftCorner,     // Polynomial-size left-corner construction
+    Matrix          // Rosenkrantz's matrix method, column-parallel
+};
+
+// What one pruning pass (or a local prune in a step) removed.
+struct PruneStats {
+    std::string stage;
+    size_t variables;
+    size_t rules;
+    size_t symbols;     // Total length of the removed bodies
+    size_t duplicates;  // Duplicate bodies rejected by the sets since the previous pass
+};
+
+// ==========================================
+// Work-Stealing Pool
+// ==========================================
+
+// Fixed set of threads, each with its own task deque. A worker pops the
+// newest task from its own deque (good locality for follow-up tasks it just
+// spawned) and, when empty, steals the oldest task from another worker.
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex idleLock;
+    std::condition_variable workAvailable; // Idle workers wait here
+    std::condition_variable allDone;       // wait() waits here
+    std::atomic<size_t> pending;   // Submitted but not yet finished
+    std::atomic<size_t> queued;    // In some deque, not yet taken
+    std::atomic<size_t> nextQueue;
+    bool stopping = false;
+
+    static size_t& currentWorker() {
+        static thread_local size_t id = static_cast<size_t>(-1);
+        return id;
+    }
+
+    bool tryPop(size_t self, std::function<void()>& task) {
+        {
+            std::lock_guard<std::mutex> guard(queues[self]->lock);
+            if (!queues[self]->tasks.empty()) {
+                task = std::move(queues[self]->tasks.back());
+                queues[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); k++) {
+            Queue& victim = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        currentWorker() = self;
+        std::function<void()> task;
+        while (true) {
+            if (tryPop(self, task)) {
+                queued--;
+                task();
+                task = nullptr;
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> guard(idleLock);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(idleLock);
+            workAvailable.wait(guard, [this]() { return stopping || queued > 0; });
+            if (stopping) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned threadCount) : pending(0), queued(0), nextQueue(0) {
+        for (unsigned i = 0; i < threadCount; i++) queues.emplace_back(new Queue());
+        for (unsigned i = 0; i < threadCount; i++) threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(idleLock);
+            stopping = true;
+            workAvailable.notify_all();
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    // From a worker the task goes to that worker's own deque; from outside
+    // the pool, submissions are spread round-robin. 'queued' is raised
+    // before the push, so a worker can't take the task first and wrap it,
+    // and under idleLock, so a worker about to sleep can't miss it.
+    void submit(std::function<void()> task) {
+        size_t self = currentWorker();
+        size_t target = self < queues.size() ? self : nextQueue++ % queues.size();
+        pending++;
+        {
+            std::lock_guard<std::mutex> guard(idleLock);
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> guard(queues[target]->lock);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        workAvailable.notify_one();
+    }
+
+    // Blocks until every submitted task (including ones submitted by tasks) has run.
+    void wait() {
+        std::unique_lock<std::mutex> guard(idleLock);
+        allDone.wait(guard, [this]() { return pending == 0; });
+    }
+};
+
+// ==========================================
+// GNF Construction Algorithm
+// ==========================================
+
+class GNFConverter {
+private:
+    Grammar grammar;                              // Materialized view of 'rules'
+    std::vector<Symbol> orderedVariables;
+    std::vector<Symbol> zVariables;               // Created by eliminateLeftRecursion, in order
+    std::unordered_map<Symbol, size_t> rank;      // Position of each A_i in orderedVariables
+    bool verbose = true; // Print the grammar after each step
+    unsigned threads = 1; // Back substitution workers; 1 = sequential
+    bool pruning = false; // Run pruneUseless() between stages
+    GNFAlgorithm algorithm = GNFAlgorithm::Substitution;
+    bool hasStart = false;
+    Symbol startSymbol = {0};
+    std::atomic<size_t> duplicateHits; // Bodies dropped because the head already had them
+    std::vector<PruneStats> stats;
+    std::vector<StageRecord> stages;
+    std::ostream* statsOut = nullptr; // JSON lines sink, if any
+    GrammarWriter* sink = nullptr;    // Receives each head as soon as it is final
+    std::mutex sinkLock;
+    std::unordered_map<Symbol, Symbol> zOf;       // A -> Z_A, reused when A is redone
+
+    // Resource limits for steps 3-5 (0 = none). Passing one sets 'aborted',
+    // and the step loops unwind at their next check.
+    size_t maxBytes = 0;
+    size_t maxRules = 0;
+    std::atomic<size_t> liveRules;  // Rules in the working grammar, kept while budgeted
+    std::atomic<bool> aborted;
+    std::string abortReason;
+    std::mutex abortLock;
+    std::string spillDirectory;     // Non-empty: spill finalized heads in step 5
+    size_t spillThreshold = 0;
+    SpillStore spill;
+
+    // Working grammar, indexed by first symbol: rules[A][X] holds the bodies
+    // of A that start with X (an empty body is filed under emptyKey()). Each
+    // body lives in exactly one bucket, so the buckets are the storage and
+    // every step only visits the bodies it rewrites.
+    typedef std::map<Symbol, Productions> LeadingBuckets;
+    std::unordered_map<Symbol, LeadingBuckets> rules;
+    static Symbol emptyKey() { return Symbol{Symbol::INDEX_MASK}; }
+
+    // Incremental mode: run() keeps what steps 3 and 5 read for each head,
+    // so an edit only redoes the heads it reaches (see addRule).
+    bool incremental = false;
+    bool converted = false;
+    Grammar source;                                               // The rules as given, with edits applied
+    std::unordered_map<Symbol, LeadingBuckets> forward;           // Every head after steps 3-4
+    std::unordered_map<Symbol, std::vector<Symbol>> forwardDeps;  // A_j substituted into A_i in step 3, plus unranked leading variables
+    std::unordered_map<Symbol, std::vector<Symbol>> backDeps;     // Variables leading a body of the head when step 5 began
+    size_t recomputed = 0;
+
+    // Returns false if the body was already there.
+    bool addTo(LeadingBuckets& buckets, const ProductionBody& body) {
+        if (buckets[body.empty() ? emptyKey() : body.front()].insert(body).second) return true;
+        duplicateHits++;
+        return false;
+    }
+
+    void addProduction(Symbol head, const ProductionBody& body) {
+        if (addTo(rules[head], body) && budgeted()) charge(1);
+    }
+
+    bool budgeted() const { return maxBytes || maxRules; }
+
+    // Counts n new rules and checks both limits.
+    void charge(size_t n) {
+        size_t total = liveRules += n;
+        if (maxRules && total > maxRules) {
+            stop("the working grammar passed " + std::to_string(maxRules) + " rules");
+        } else if (maxBytes && AllocationStats::live() > maxBytes) {
+            stop("the live heap passed " + std::to_string(maxBytes >> 20) + " MB");
+        }
+    }
+
+    void stop(const std::string& reason) {
+        std::lock_guard<std::mutex> guard(abortLock);
+        if (!aborted.exchange(true)) abortReason = reason;
+    }
+
+    // Calls f(first, last) with the symbols of every body of 'head', in
+    // memory or spilled. Spilled bodies are not consed.
+    template <typename F>
+    void forEachSymbols(Symbol head, F f) const {
+        auto byFirst = rules.find(head);
+        if (byFirst == rules.end()) return;
+        if (byFirst->second.empty() && spill.isOpen()) {
+            spill.get(head, f);
+            return;
+        }
+        SmallVector<Symbol, 16> symbolsOf;
+        for (const auto& bucket : byFirst->second) {
+            for (const auto& body : bucket.second) {
+                symbolsOf.clear();
+                for (Symbol sym : body) symbolsOf.push_back(sym);
+                f(symbolsOf.begin(), symbolsOf.end());
+            }
+        }
+    }
+
+    // Calls f(body) for every body of 'head', in memory or spilled.
+    // Spilled bodies are consed in the current BodyScope.
+    template <typename F>
+    void forEachBody(Symbol head, F f) const {
+        auto byFirst = rules.find(head);
+        if (byFirst == rules.end()) return;
+        if (byFirst->second.empty() && spill.isOpen()) {
+            spill.get(head, [&f](const Symbol* first, const Symbol* last) { f(ProductionBody(first, last)); });
+            return;
+        }
+        for (const auto& bucket : byFirst->second) {
+            for (const auto& body : bucket.second) f(body);
+        }
+    }
+
+    // Moves a finalized head's rules to the spill file.
+    void spillHead(Symbol head) {
+        auto byFirst = rules.find(head);
+        if (byFirst == rules.end() || byFirst->second.empty()) return;
+        bool written = spill.put(head, [&](const std::function<void(const ProductionBody&)>& f) {
+            for (const auto& bucket : byFirst->second) {
+                for (const auto& body : bucket.second) f(body);
+            }
+        });
+        if (!written) {
+            stop("the spill file could not be written");
+            return;
+        }
+        LeadingBuckets().swap(byFirst->second);
+    }
+
+    bool maybeSpill(Symbol head) {
+        if (!spill.isOpen() || (spillThreshold && AllocationStats::live() <= spillThreshold)) return false;
+        spillHead(head);
+        return !aborted;
+    }
+
+    // Step 5 for one head. With spilling, its new bodies are consed in a
+    // store of their own: if the head is spilled the store is freed with
+    // them, otherwise they are consed again into bodyStore(), so only
+    // heads kept in memory hold nodes there.
+    void finalizeHead(Symbol head) {
+        if (!spill.isOpen()) {
+            substituteUntilTerminal(head);
+            return;
+        }
+        std::unique_ptr<BodyStore> scope(new BodyStore(&bodyStore()));
+        {
+            BodyScope consHere(scope.get());
+            substituteUntilTerminal(head);
+        }
+        if (!aborted && maybeSpill(head)) return;
+        auto byFirst = rules.find(head);
+        if (byFirst == rules.end()) return;
+        LeadingBuckets kept;
+        SmallVector<Symbol, 16> symbolsOf;
+        for (const auto& bucket : byFirst->second) {
+            Productions& out = kept[bucket.first];
+            for (const auto& body : bucket.second) {
+                symbolsOf.clear();
+                for (Symbol sym : body) symbolsOf.push_back(sym);
+                out.insert(ProductionBody(symbolsOf.begin(), symbolsOf.end()));
+            }
+        }
+        byFirst->second.swap(kept);
+    }
+
+    // Removes and returns every body of 'head' that starts with 'first'.
+    Productions takeLeading(Symbol head, Symbol first) {
+        Productions taken;
+        auto byFirst = rules.find(head);
+        if (byFirst == rules.end()) return taken;
+        auto bucket = byFirst->second.find(first);
+        if (bucket == byFirst->second.end()) return taken;
+
+        taken.swap(bucket->second);
+        byFirst->second.erase(bucket);
+        if (budgeted()) liveRules -= taken.size();
+        return taken;
+    }
+
+    // Variables that currently lead some body of 'head'.
+    std::vector<Symbol> leadingVariables(Symbol head) const {
+        std::vector<Symbol> vars;
+        auto byFirst = rules.find(head);
+        if (byFirst == rules.end()) return vars;
+        for (const auto& bucket : byFirst->second) {
+            if (bucket.first.type() == VARIABLE) vars.push_back(bucket.first);
+        }
+        return vars;
+    }
+
+    // All bodies of 'head', concatenated with 'suffix', added to 'target'.
+    // Only looks entries up (never inserts heads), so parallel back
+    // substitution can run it for different targets at once.
+    // With a budget, new rules are charged in batches; once the conversion
+    // is aborted the rest of the substitution is skipped.
+    void addSubstituted(LeadingBuckets& target, Symbol head, const ProductionBody& suffix) {
+        size_t added = 0;
+        forEachBody(head, [&](const ProductionBody& repl) {
+            if (aborted) return;
+            added += addTo(target, ProductionBody::concat(repl, suffix));
+            if (added >= 4096 && budgeted()) {
+                charge(added);
+                added = 0;
+            }
+        });
+        if (added && budgeted()) charge(added);
+    }
+
+    bool streamsEachHead() const { return sink && !pruning; }
+
+    void streamRule(Symbol head) {
+        if (!rules.count(head)) return;
+        sink->beginRule(head);
+        forEachSymbols(head, [this](const Symbol* first, const Symbol* last) { sink->addBody(first, last); });
+        sink->endRule();
+    }
+
+    // Spilled heads are read back into the copy.
+    const Grammar& materialize() {
+        grammar.clear();
+        for (const auto& byFirst : rules) {
+            Productions& out = grammar[byFirst.first];
+            forEachBody(byFirst.first, [&out](const ProductionBody& body) { out.insert(body); });
+        }
+        return grammar;
+    }
+
+    Symbol start() {
+        if (!hasStart) {
+            // Default: the lowest-ordered variable, i.e. A_1.
+            for (const auto& pair : rules) {
+                Symbol v = pair.first;
+                if (!hasStart || orderedBefore(v, startSymbol)) startSymbol = v;
+                hasStart = true;
+            }
+        }
+        return startSymbol;
+    }
+
+    // Removes 'head' from the working grammar and from the step orderings.
+    void dropVariable(Symbol head) {
+        rules.erase(head);
+        orderedVariables.erase(std::remove(orderedVariables.begin(), orderedVariables.end(), head), orderedVariables.end());
+        zVariables.erase(std::remove(zVariables.begin(), zVariables.end(), head), zVariables.end());
+    }
+
+    // Replays steps 3-5 after 'head' changed in 'source'. Step 3 is redone
+    // in rank order for A_i that are edited or substituted a redone head
+    // (on the step 3 state, swapped into 'rules'); step 5 in its usual
+    // order for heads that were redone or lead with a redone head.
+    void update(Symbol head) {
+        if (!rank.count(head)) {
+            auto at = std::lower_bound(orderedVariables.begin(), orderedVariables.end(), head, orderedBefore);
+            orderedVariables.insert(at, head);
+            for (size_t i = 0; i < orderedVariables.size(); ++i) rank[orderedVariables[i]] = i;
+        }
+
+        std::unordered_set<Symbol> dirty;
+        dirty.insert(head);
+        rules.swap(forward);
+        for (size_t i = 0; i < orderedVariables.size(); ++i) {
+            Symbol Ai = orderedVariables[i];
+            if (!dirty.count(Ai)) {
+                const std::vector<Symbol>& deps = forwardDeps[Ai];
+                if (std::none_of(deps.begin(), deps.end(), [&](Symbol X) { return dirty.count(X) != 0; })) continue;
+                dirty.insert(Ai);
+            }
+            LeadingBuckets& buckets = rules[Ai];
+            buckets.clear();
+            for (const auto& body : source[Ai]) addTo(buckets, body);
+            auto z = zOf.find(Ai);
+            if (z != zOf.end()) rules.erase(z->second);
+            forwardSubstitute(i);
+            z = zOf.find(Ai);
+            if (z != zOf.end()) dirty.insert(z->second);
+        }
+        rules.swap(forward);
+
+        // Keep Z order stable; drop Zs that lost their rules, re-add revived ones.
+        std::unordered_set<Symbol> listed;
+        std::vector<Symbol> zs;
+        for (const Symbol& Z : zVariables) {
+            if (forward.count(Z) && listed.insert(Z).second) zs.push_back(Z);
+        }
+        for (const Symbol& A : orderedVariables) {
+            auto z = zOf.find(A);
+            if (z != zOf.end() && dirty.count(z->second) && forward.count(z->second) && listed.insert(z->second).second) {
+                zs.push_back(z->second);
+            }
+        }
+        zVariables.swap(zs);
+        for (const Symbol& X : dirty) {
+            if (!forward.count(X)) rules.erase(X);
+        }
+
+        std::vector<Symbol> order(orderedVariables.rbegin(), orderedVariables.rend());
+        order.insert(order.end(), zVariables.begin(), zVariables.end());
+        recomputed = 0;
+        for (const Symbol& X : order) {
+            std::vector<Symbol>& deps = backDeps[X];
+            if (!dirty.count(X)) {
+                if (std::none_of(deps.begin(), deps.end(), [&](Symbol Y) { return dirty.count(Y) != 0; })) continue;
+                dirty.insert(X);
+            }
+            rules[X] = forward[X];
+            deps = leadingVariables(X);
+            substituteUntilTerminal(X);
+            recomputed++;
+        }
+    }
+
+    bool edit(Symbol head, const ProductionBody& body, bool adding) {
+        if (!incremental || !converted) {
+            std::cerr << "Error: rule edits need setIncremental(true) and a run() first." << std::endl;
+            return false;
+        }
+        if (head.type() != VARIABLE) {
+            std::cerr << "Error: rule head " << head.name() << " is not a variable." << std::endl;
+            return false;
+        }
+        recomputed = 0;
+        auto known = source.find(head);
+        if (adding) {
+            if (!source[head].insert(body).second) return false;
+        } else if (known == source.end() || !known->second.erase(body)) {
+            return false;
+        }
+        aborted = false;
+        if (budgeted()) liveRules = measure().first;
+        update(head);
+        if (aborted) {
+            std::cerr << "Error: the edit stopped because " << abortReason
+                      << "; the converted grammar is incomplete." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Counts (rules, symbols) currently in the working grammar.
+    std::pair<size_t, size_t> measure() const {
+        size_t ruleCount = 0, symbolCount = 0;
+        for (const auto& byFirst : rules) {
+            for (const auto& bucket : byFirst.second) {
+                ruleCount += bucket.second.size();
+                for (const auto& body : bucket.second) symbolCount += body.size();
+            }
+        }
+        if (spill.isOpen()) {
+            ruleCount += spill.bodies();
+            symbolCount += spill.symbolCount();
+        }
+        return std::make_pair(ruleCount, symbolCount);
+    }
+
+public:
+    GNFConverter(const Grammar& initialGrammar) : duplicateHits(0), liveRules(0), aborted(false) {
+        for (const auto& pair : initialGrammar) {
+            rules[pair.first];
+            for (const auto& body : pair.second) addProduction(pair.first, body);
+        }
+    }
+
+    void setVerbose(bool v) { verbose = v; }
+    void setPruning(bool p) { pruning = p; }
+    void setAlgorithm(GNFAlgorithm a) { algorithm = a; }
+    void setStartSymbol(Symbol s) { startSymbol = s; hasStart = true; }
+    const std::vector<PruneStats>& pruneStats() const { return stats; }
+    // Each stage of run() appends a StageRecord; with a stream set, it is
+    // also written there as one JSON line as soon as the stage ends.
+    // The record's heap bytes are 0 unless AllocationStats is counting,
+    // which a stream turns on.
+    void setStatsStream(std::ostream* out) {
+        statsOut = out;
+        if (out) AllocationStats::enable();
+    }
+    const std::vector<StageRecord>& stageRecords() const { return stages; }
+    // Streams the final rules to 'writer' while the conversion runs: each
+    // head is written as soon as step 5 finalizes it, in the sequential
+    // step-5 order even when running in parallel. With pruning, the final
+    // pass can still drop heads, so the grammar is written once it is done.
+    void setRuleSink(GrammarWriter* writer) { sink = writer; }
+    // Worker threads for step 5 (0 = one per hardware thread).
+    void setThreads(unsigned n) { threads = n ? n : std::max(1u, std::thread::hardware_concurrency()); }
+    const Grammar& result() { return materialize(); }
+    // Heads, rules and symbols of the current grammar; spilled heads are
+    // counted without reading them back.
+    size_t variableCount() const { return rules.size(); }
+    std::pair<size_t, size_t> ruleAndSymbolCount() const { return measure(); }
+
+    // Step 2: Renaming/Ordering
+    // Collects variables and sorts them (Simulating A_1...A_m assignment)
+    void step2_Ordering() {
+        orderedVariables.clear();
+        for (auto& pair : rules) {
+            if (pair.first.type() == VARIABLE) {
+                orderedVariables.push_back(pair.first);
+            }
+        }
+        // Sort based on index (ties by id, since 'rules' is unordered)
+        std::sort(orderedVariables.begin(), orderedVariables.end(), orderedBefore);
+        rank.clear();
+        for (size_t i = 0; i < orderedVariables.size(); ++i) rank[orderedVariables[i]] = i;
+
+        if (verbose) printGrammar(materialize(), "Step 2: Variables Ordered");
+    }
+
+    // Step 3: Lemma 1 & Forward Substitution
+    // Transform rules so that if A_i -> A_j alpha, then j > i.
+    // The index gives the leading variables of A_i directly, so instead of
+    // scanning all of A_i's rules for every j < i we repeatedly take the
+    // lowest-ranked leading A_j (j < i) and substitute only its bucket.
+    void step3_ForwardSubstitution() {
+        for (size_t i = 0; i < orderedVariables.size() && !aborted; ++i) {
+            forwardSubstitute(i);
+        }
+        if (aborted) return;
+        if (incremental) forward = rules;
+        if (verbose) printGrammar(materialize(), "Step 3: Forward Substitution & Recursion Elimination");
+    }
+
+    // Steps 3 and 4 for A_i, which only read A_j with j < i.
+    void forwardSubstitute(size_t i) {
+        Symbol Ai = orderedVariables[i];
+        std::vector<Symbol>* deps = incremental ? &forwardDeps[Ai] : nullptr;
+        if (deps) deps->clear();
+
+        while (!aborted) {
+            // Detect A_i -> A_j alpha with the smallest j < i
+            bool found = false;
+            Symbol Aj = Ai;
+            for (const Symbol& X : leadingVariables(Ai)) {
+                auto r = rank.find(X);
+                if (r == rank.end() || r->second >= i) continue;
+                if (!found || r->second < rank[Aj]) Aj = X;
+                found = true;
+            }
+            if (!found) break;
+            if (deps) deps->push_back(Aj);
+
+            // Substitute A_j with its bodies: beta alpha, sharing alpha.
+            // A_j's bodies lead with A_k, k > j, so this terminates.
+            for (const auto& body : takeLeading(Ai, Aj)) {
+                addSubstituted(rules[Ai], Aj, body.tail());
+            }
+        }
+        if (aborted) return;
+        // A variable without rules yet is not substituted, unless an edit gives it some.
+        if (deps) {
+            for (const Symbol& X : leadingVariables(Ai)) {
+                if (!rank.count(X)) deps->push_back(X);
+            }
+        }
+        eliminateLeftRecursion(Ai);
+    }
+
+    // Step 4: Eliminate Immediate Left Recursion
+    // Transforms A -> A alpha | beta  into  A -> beta Z?, Z -> alpha Z?
+    void eliminateLeftRecursion(Symbol A) {
+        // The A-bucket of the index is exactly the left-recursive bodies.
+        Productions recursive = takeLeading(A, A);
+        if (recursive.empty()) return;
+
+        Productions betaRules;
+        for (const auto& bucket : rules[A]) betaRules.insert(bucket.second.begin(), bucket.second.end());
+
+        // A -> A alpha with no beta: A derives no terminal string, so with
+        // pruning on the recursive rules are dropped instead of feeding a
+        // useless Z.
+        if (betaRules.empty() && pruning) {
+            PruneStats local = {"eliminateLeftRecursion(" + A.name() + ")", 0, recursive.size(), 0, 0};
+            for (const auto& body : recursive) local.symbols += body.size();
+            stats.push_back(local);
+            return;
+        }
+
+        // Create new Variable Z (or reuse A's, when an edit redoes A)
+        auto known = zOf.find(A);
+        Symbol Z = known != zOf.end() ? known->second : symbols().fresh("Z_" + A.name());
+        if (known == zOf.end()) {
+            zOf[A] = Z;
+            zVariables.push_back(Z);
+        }
+
+        // A -> beta | beta Z
+        for (const auto& beta : betaRules) {
+            addProduction(A, ProductionBody::concat(beta, {Z}));
+        }
+
+        // Z -> alpha | alpha Z
+        for (const auto& body : recursive) {
+            ProductionBody alpha = body.tail();
+            addProduction(Z, alpha);
+            addProduction(Z, ProductionBody::concat(alpha, {Z}));
+        }
+    }
+
+    // Step 5: Back Substitution
+    // Ensure all rules start with a Terminal by propagating backwards from A_m to A_1.
+    void step5_BackSubstitution() {
+        // Original variables backwards, then Z variables (they might still
+        // point to Variables).
+        std::vector<Symbol> order(orderedVariables.rbegin(), orderedVariables.rend());
+        order.insert(order.end(), zVariables.begin(), zVariables.end());
+        if (incremental) {
+            for (const auto& head : order) backDeps[head] = leadingVariables(head);
+        }
+
+        if (threads <= 1 || !parallelBackSubstitution(order)) {
+            for (const auto& head : order) {
+                finalizeHead(head);
+                if (aborted) break;
+                if (streamsEachHead()) streamRule(head);
+            }
+        }
+        if (streamsEachHead()) sink->flush();
+
+        if (verbose && !aborted) printGrammar(materialize(), "Step 5: Back Substitution (Final GNF)");
+    }
+
+    // Helper to substitute the head of productions until they start with a Terminal
+    // Only the index buckets led by a variable are touched.
+    void substituteUntilTerminal(Symbol target) {
+        auto byFirst = rules.find(target);
+        if (byFirst == rules.end()) return;
+        for (const Symbol& first : leadingVariables(target)) {
+            if (aborted) return;
+            Productions replaced = takeLeading(target, first);
+            // After step 3, 'first' is never 'target' (no left recursion remains).
+            for (const auto& body : replaced) {
+                addSubstituted(byFirst->second, first, body.tail());
+            }
+        }
+    }
+
+    // Parallel step 5. After step 3 the "leads with" relation is a DAG: a
+    // head can be finalized as soon as every variable leading one of its
+    // bodies is final. Heads are scheduled on a work-stealing pool the
+    // moment their last dependency finishes. Each task only writes its own
+    // head's buckets and only reads finalized ones, and the result is a set
+    // per head, so the output is identical to the sequential order.
+    // Returns false (doing nothing) if the relation has a cycle.
+    bool parallelBackSubstitution(const std::vector<Symbol>& order) {
+        const size_t n = order.size();
+        std::unordered_map<Symbol, size_t> slot;
+        for (size_t i = 0; i < n; i++) slot[order[i]] = i;
+
+        std::vector<std::vector<size_t>> dependents(n);
+        std::vector<int> indegree(n, 0);
+        for (size_t i = 0; i < n; i++) {
+            for (const Symbol& X : leadingVariables(order[i])) {
+                auto s = slot.find(X);
+                if (s == slot.end() || s->second == i) continue;
+                dependents[s->second].push_back(i);
+                indegree[i]++;
+            }
+        }
+
+        // Kahn's algorithm on a copy, only to reject cyclic inputs up front.
+        std::vector<int> remaining(indegree);
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < n; i++) if (remaining[i] == 0) ready.push_back(i);
+        size_t visited = 0;
+        while (!ready.empty()) {
+            size_t i = ready.back();
+            ready.pop_back();
+            visited++;
+            for (size_t d : dependents[i]) if (--remaining[d] == 0) ready.push_back(d);
+        }
+        if (visited != n) return false;
+
+        std::unique_ptr<std::atomic<int>[]> waiting(new std::atomic<int>[n]);
+        for (size_t i = 0; i < n; i++) waiting[i] = indegree[i];
+
+        // Reorder buffer for the sink: head i is streamed once heads 0..i are final.
+        std::vector<char> finished(n, 0);
+        size_t nextToStream = 0;
+
+        WorkStealingPool pool(threads);
+        // Once aborted, tasks stop scheduling their dependents and the pool drains.
+        std::function<void(size_t)> finalize = [&](size_t i) {
+            // Spilled before anyone reads it: dependents are only submitted below.
+            finalizeHead(order[i]);
+            if (aborted) return;
+            if (streamsEachHead()) {
+                std::lock_guard<std::mutex> guard(sinkLock);
+                finished[i] = 1;
+                while (nextToStream < n && finished[nextToStream]) streamRule(order[nextToStream++]);
+            }
+            for (size_t d : dependents[i]) {
+                if (--waiting[d] == 0) pool.submit([&finalize, d]() { finalize(d); });
+            }
+        };
+        for (size_t i = 0; i < n; i++) {
+            if (indegree[i] == 0) pool.submit([&finalize, i]() { finalize(i); });
+        }
+        pool.wait();
+        return true;
+    }
+
+    // Alternative to steps 2-5 with guaranteed polynomial output size: the
+    // left-corner transform (Rosenkrantz & Lewis), specialised to produce GNF
+    // directly as in Blum & Koch's construction. A new variable [A,B] derives
+    // what remains of an A once its left corner B has been recognized:
+    //   A     -> a beta [A,B]   for each B -> a beta   (and A -> a beta if B = A)
+    //   [A,B] -> beta [A,C]     for each C -> B beta   (and [A,B] -> beta if C = A)
+    // and a variable Y leading beta in the second form is replaced by Y's
+    // rules of the first form, which all start with a terminal. Only pairs
+    // with B a left corner of A are built. The result has at most
+    // |N|^2 + |N| variables and O(|N| * |P|^2) productions, where substitution
+    // can grow exponentially.
+    // Requires an epsilon-free grammar without unit rules A -> B; returns
+    // false (grammar untouched) otherwise.
+    bool leftCornerConstruction() {
+        struct Rule { Symbol head; ProductionBody body; };
+        std::vector<Rule> source;
+        std::vector<Symbol> vars;
+        std::unordered_map<Symbol, size_t> varId;
+        auto idOf = [&](Symbol v) {
+            auto found = varId.find(v);
+            if (found != varId.end()) return found->second;
+            varId[v] = vars.size();
+            vars.push_back(v);
+            return vars.size() - 1;
+        };
+
+        for (const auto& byFirst : rules) {
+            idOf(byFirst.first);
+            for (const auto& bucket : byFirst.second) {
+                for (const auto& body : bucket.second) {
+                    if (body.empty() || (body.size() == 1 && body.front().type() == VARIABLE)) {
+                        std::cerr << "Left-corner construction needs an epsilon-free grammar without unit rules ("
+                                  << byFirst.first.name() << " -> " << (body.empty() ? "epsilon" : body.front().name())
+                                  << ")." << std::endl;
+                        return false;
+                    }
+                    source.push_back({byFirst.first, body});
+                }
+            }
+        }
+        for (const auto& r : source) {
+            for (Symbol s : r.body) if (s.type() == VARIABLE) idOf(s);
+        }
+        Symbol S = start();
+        const size_t n = vars.size();
+
+        // corner[A][B]: B is a left corner of A (A =>* B gamma via leftmost
+        // variables, reflexive). Transitive closure by propagation.
+        std::vector<std::vector<char>> corner(n, std::vector<char>(n, 0));
+        std::vector<std::vector<size_t>> direct(n);
+        for (const auto& r : source) {
+            if (r.body.front().type() == VARIABLE) direct[varId[r.head]].push_back(varId[r.body.front()]);
+        }
+        for (size_t A = 0; A < n; A++) {
+            std::vector<size_t> frontier(1, A);
+            corner[A][A] = 1;
+            while (!frontier.empty()) {
+                size_t X = frontier.back();
+                frontier.pop_back();
+                for (size_t Y : direct[X]) {
+                    if (!corner[A][Y]) { corner[A][Y] = 1; frontier.push_back(Y); }
+                }
+            }
+        }
+
+        std::map<std::pair<size_t, size_t>, Symbol> pairVars;
+        auto pairVar = [&](size_t A, size_t B) {
+            auto found = pairVars.find(std::make_pair(A, B));
+            if (found != pairVars.end()) return found->second;
+            Symbol v = symbols().fresh("[" + vars[A].name() + "," + vars[B].name() + "]");
+            pairVars[std::make_pair(A, B)] = v;
+            return v;
+        };
+
+        // First form: A -> a beta [A,B] | a beta (B = A).
+        std::vector<std::vector<ProductionBody>> first(n);
+        for (size_t A = 0; A < n; A++) {
+            for (const auto& r : source) {
+                if (r.body.front().type() != TERMINAL) continue;
+                size_t B = varId[r.head];
+                if (!corner[A][B]) continue;
+                first[A].push_back(ProductionBody::concat(r.body, {pairVar(A, B)}));
+                if (B == A) first[A].push_back(r.body);
+            }
+        }
+
+        // Second form: [A,B] -> beta [A,C] | beta (C = A), leading Y of beta
+        // replaced by Y's first-form rules.
+        std::vector<std::pair<Symbol, ProductionBody>> second;
+        for (size_t A = 0; A < n; A++) {
+            for (const auto& r : source) {
+                if (r.body.front().type() != VARIABLE) continue;
+                size_t B = varId[r.body.front()];
+                size_t C = varId[r.head];
+                if (!corner[A][C]) continue; // [A,C] would be useless
+                Symbol head = pairVar(A, B);
+                ProductionBody beta = r.body.tail();
+
+                std::vector<ProductionBody> tails(1, ProductionBody{pairVar(A, C)});
+                if (C == A) tails.push_back(ProductionBody());
+                for (const auto& t : tails) {
+                    if (beta.front().type() == TERMINAL) {
+                        second.push_back(std::make_pair(head, ProductionBody::concat(beta, t)));
+                        continue;
+                    }
+                    ProductionBody rest = ProductionBody::concat(beta.tail(), t);
+                    for (const auto& lead : first[varId[beta.front()]]) {
+                        second.push_back(std::make_pair(head, ProductionBody::concat(lead, rest)));
+                    }
+                }
+            }
+        }
+
+        rules.clear();
+        orderedVariables.clear();
+        zVariables.clear();
+        rank.clear();
+        for (size_t A = 0; A < n; A++) {
+            rules[vars[A]];
+            for (const auto& body : first[A]) addProduction(vars[A], body);
+        }
+        for (const auto& rule : second) addProduction(rule.first, rule.second);
+        setStartSymbol(S);
+
+        // Pairs that are not productive (or not reachable) are expected here.
+        pruneUseless("after left-corner construction");
+        if (sink) {
+            for (const auto& pair : materialize()) streamRule(pair.first);
+            sink->flush();
+        }
+        if (verbose) printGrammar(materialize(), "Left-Corner Construction (Final GNF)");
+        return true;
+    }
+
+    // Rosenkrantz's matrix method. With the variables as a row vector X,
+    // the grammar is the linear system X = X R + S over production sets:
+    // R[k][j] holds alpha for each A_j -> A_k alpha, and S[j] the bodies of
+    // A_j that start with a terminal. Its solution is X = S + S Y with
+    // Y = R+ = R + R Y, so with a new variable Y_kj per nonzero entry of R+:
+    //   A_j  -> s          for each s in S[j]
+    //   A_j  -> s Y_kj     for each s in S[k]
+    //   Y_kj -> alpha      for each alpha in R[k][j]
+    //   Y_kj -> alpha Y_lj for each alpha in R[k][l]
+    // where alpha's leading variable, if any, is replaced by its A rules,
+    // which all start with a terminal. The grammar is the left-corner one
+    // (Y_kj is [A_j,A_k]), but built as whole-matrix operations: the
+    // pattern of R+ is a bitset closure, every alpha is expanded once and
+    // shared by all columns, and the columns of A and Y rules are
+    // independent tasks, run on setThreads() workers.
+    // Same requirements as leftCornerConstruction(); returns false
+    // (grammar untouched) otherwise.
+    bool matrixConstruction() {
+        std::vector<Symbol> vars;
+        std::unordered_map<Symbol, size_t> varId;
+        auto idOf = [&](Symbol v) {
+            auto found = varId.find(v);
+            if (found != varId.end()) return found->second;
+            varId[v] = vars.size();
+            vars.push_back(v);
+            return vars.size() - 1;
+        };
+        for (const auto& byFirst : rules) {
+            idOf(byFirst.first);
+            for (const auto& bucket : byFirst.second) {
+                for (const auto& body : bucket.second) {
+                    if (body.empty() || (body.size() == 1 && body.front().type() == VARIABLE)) {
+                        std::cerr << "Matrix construction needs an epsilon-free grammar without unit rules ("
+                                  << byFirst.first.name() << " -> " << (body.empty() ? "epsilon" : body.front().name())
+                                  << ")." << std::endl;
+                        return false;
+                    }
+                    for (Symbol s : body) if (s.type() == VARIABLE) idOf(s);
+                }
+            }
+        }
+        Symbol S0 = start();
+        const size_t n = vars.size();
+        const size_t words = (n + 63) / 64;
+
+        // S as a vector, R as sparse rows: R[k] = (j, alpha) pairs.
+        std::vector<std::vector<ProductionBody>> S(n);
+        std::vector<std::vector<std::pair<size_t, ProductionBody>>> R(n);
+        for (const auto& byFirst : rules) {
+            size_t j = varId[byFirst.first];
+            for (const auto& bucket : byFirst.second) {
+                for (const auto& body : bucket.second) {
+                    if (body.front().type() == TERMINAL) {
+                        S[j].push_back(body);
+                    } else {
+                        R[varId[body.front()]].push_back(std::make_pair(j, body.tail()));
+                    }
+                }
+            }
+        }
+
+        // Pattern of R+: row k has bit j if Y_kj is nonzero. Warshall over
+        // bitset rows.
+        std::vector<uint64_t> plus(n * words, 0);
+        auto has = [&](size_t k, size_t j) { return (plus[k * words + (j >> 6)] >> (j & 63)) & 1u; };
+        for (size_t k = 0; k < n; k++) {
+            for (const auto& entry : R[k]) plus[k * words + (entry.first >> 6)] |= uint64_t(1) << (entry.first & 63);
+        }
+        for (size_t m = 0; m < n; m++) {
+            const uint64_t* through = &plus[m * words];
+            for (size_t k = 0; k < n; k++) {
+                if (!has(k, m)) continue;
+                uint64_t* row = &plus[k * words];
+                for (size_t w = 0; w < words; w++) row[w] |= through[w];
+            }
+        }
+
+        // Y variables are named up front: the symbol table is not shared
+        // safely between the column tasks.
+        std::vector<Symbol> Y(n * n, Symbol{0});
+        for (size_t k = 0; k < n; k++) {
+            for (size_t j = 0; j < n; j++) {
+                if (has(k, j)) Y[k * n + j] = symbols().fresh("Y_" + vars[k].name() + "_" + vars[j].name());
+            }
+        }
+
+        WorkStealingPool pool(threads);
+        // Runs task(0) ... task(n - 1) on the pool and waits for them.
+        auto eachIndex = [&](const std::function<void(size_t)>& task) {
+            for (size_t j = 0; j < n; j++) pool.submit([&task, j]() { task(j); });
+            pool.wait();
+        };
+
+        // X = S + S Y, one column (head A_j) per task.
+        std::vector<std::vector<ProductionBody>> X(n);
+        eachIndex([&](size_t j) {
+            X[j] = S[j];
+            for (size_t k = 0; k < n; k++) {
+                if (!has(k, j)) continue;
+                for (const auto& s : S[k]) X[j].push_back(ProductionBody::concat(s, {Y[k * n + j]}));
+            }
+        });
+
+        // Every alpha of R with its leading variable replaced by that
+        // variable's X bodies, once for all the columns that use it.
+        std::vector<std::vector<std::vector<ProductionBody>>> expanded(n);
+        eachIndex([&](size_t k) {
+            expanded[k].resize(R[k].size());
+            for (size_t e = 0; e < R[k].size(); e++) {
+                const ProductionBody& alpha = R[k][e].second;
+                std::vector<ProductionBody>& out = expanded[k][e];
+                if (alpha.front().type() == TERMINAL) {
+                    out.push_back(alpha);
+                } else {
+                    for (const auto& lead : X[varId[alpha.front()]]) out.push_back(ProductionBody::concat(lead, alpha.tail()));
+                }
+            }
+        });
+
+        // Y = R + R Y, one column of Y per task.
+        std::vector<std::vector<std::pair<Symbol, ProductionBody>>> columns(n);
+        eachIndex([&](size_t j) {
+            for (size_t k = 0; k < n; k++) {
+                if (!has(k, j)) continue;
+                Symbol head = Y[k * n + j];
+                for (size_t e = 0; e < R[k].size(); e++) {
+                    size_t l = R[k][e].first;
+                    for (const auto& body : expanded[k][e]) {
+                        if (l == j) columns[j].push_back(std::make_pair(head, body));
+                        if (has(l, j)) columns[j].push_back(std::make_pair(head, ProductionBody::concat(body, {Y[l * n + j]})));
+                    }
+                }
+            }
+        });
+
+        rules.clear();
+        orderedVariables.clear();
+        zVariables.clear();
+        rank.clear();
+        for (size_t j = 0; j < n; j++) {
+            rules[vars[j]];
+            for (const auto& body : X[j]) addProduction(vars[j], body);
+        }
+        for (const auto& column : columns) {
+            for (const auto& rule : column) addProduction(rule.first, rule.second);
+        }
+        setStartSymbol(S0);
+
+        pruneUseless("after matrix construction");
+        if (sink) {
+            for (const auto& pair : materialize()) streamRule(pair.first);
+            sink->flush();
+        }
+        if (verbose) printGrammar(materialize(), "Matrix Construction (Final GNF)");
+        return true;
+    }
+
+    // Useless-symbol and duplicate-rule pruning; safe between any two steps.
+    //  1. Drops self-unit rules A -> A (they add nothing to the language).
+    //  2. Keeps only productive variables (those deriving a terminal string)
+    //     and drops every body that mentions an unproductive one.
+    //  3. Keeps only variables reachable from the start symbol.
+    // Exact duplicate bodies never reach the grammar (Productions is a set);
+    // how many were rejected since the last pass is recorded as well.
+    void pruneUseless(const std::string& stage) {
+        std::pair<size_t, size_t> before = measure();
+        size_t variablesBefore = rules.size();
+        PruneStats entry = {stage, 0, 0, 0, duplicateHits.exchange(0)};
+
+        for (auto& byFirst : rules) {
+            auto self = byFirst.second.find(byFirst.first);
+            if (self == byFirst.second.end()) continue;
+            self->second.erase(ProductionBody{byFirst.first});
+            if (self->second.empty()) byFirst.second.erase(self);
+        }
+
+        // Productive: fixpoint over "some body consists of terminals and productive variables".
+        std::unordered_set<Symbol> productive;
+        auto bodyProductive = [&productive](const ProductionBody& body) {
+            for (Symbol s : body) {
+                if (s.type() == VARIABLE && !productive.count(s)) return false;
+            }
+            return true;
+        };
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (const auto& byFirst : rules) {
+                if (productive.count(byFirst.first)) continue;
+                bool found = false;
+                for (const auto& bucket : byFirst.second) {
+                    for (const auto& body : bucket.second) {
+                        if (bodyProductive(body)) { found = true; break; }
+                    }
+                    if (found) break;
+                }
+                if (found) {
+                    productive.insert(byFirst.first);
+                    changed = true;
+                }
+            }
+        }
+
+        // Reachable from the start symbol through productive bodies only.
+        std::unordered_set<Symbol> reachable;
+        std::vector<Symbol> frontier;
+        if (productive.count(start())) {
+            reachable.insert(start());
+            frontier.push_back(start());
+        }
+        while (!frontier.empty()) {
+            Symbol head = frontier.back();
+            frontier.pop_back();
+            for (const auto& bucket : rules[head]) {
+                for (const auto& body : bucket.second) {
+                    if (!bodyProductive(body)) continue;
+                    for (Symbol s : body) {
+                        if (s.type() == VARIABLE && reachable.insert(s).second) frontier.push_back(s);
+                    }
+                }
+            }
+        }
+
+        std::vector<Symbol> useless;
+        for (auto& byFirst : rules) {
+            if (!reachable.count(byFirst.first)) {
+                useless.push_back(byFirst.first);
+                continue;
+            }
+            for (auto bucket = byFirst.second.begin(); bucket != byFirst.second.end();) {
+                Productions& bodies = bucket->second;
+                for (auto it = bodies.begin(); it != bodies.end();) {
+                    it = bodyProductive(*it) ? std::next(it) : bodies.erase(it);
+                }
+                bucket = bodies.empty() ? byFirst.second.erase(bucket) : std::next(bucket);
+            }
+        }
+        for (Symbol head : useless) dropVariable(head);
+        rank.clear();
+        for (size_t i = 0; i < orderedVariables.size(); ++i) rank[orderedVariables[i]] = i;
+
+        std::pair<size_t, size_t> after = measure();
+        entry.variables = variablesBefore - rules.size();
+        entry.rules = before.first - after.first;
+        entry.symbols = before.second - after.second;
+        stats.push_back(entry);
+    }
+
+    void printPruneStats() const {
+        std::cout << "--- Pruning Statistics ---" << std::endl;
+        for (const auto& s : stats) {
+            std::cout << "  " << s.stage << ": removed " << s.variables << " variables, "
+                      << s.rules << " rules, " << s.symbols << " symbols; "
+                      << s.duplicates << " duplicate bodies rejected" << std::endl;
+        }
+        std::cout << "--------------------------------" << std::endl << std::endl;
+    }
+
+    // Runs 'body' as a measured stage. The timing includes any grammar dump
+    // the stage prints, so dumps should be off (setVerbose(false)) when the
+    // numbers matter.
+    template <typename Fn>
+    void stage(const std::string& name, Fn body) {
+        AllocationStats::resetPeak();
+        if (budgeted()) liveRules = measure().first;
+        auto begin = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::pair<size_t, size_t> size = measure();
+        StageRecord record = {name, seconds, rules.size(), size.first, size.second,
+                              AllocationStats::peak().load(), AllocationStats::live().load()};
+        stages.push_back(record);
+        if (statsOut) {
+            record.writeJson(*statsOut);
+            statsOut->flush();
+        }
+    }
+
+    // Returns false if a budget stopped the conversion (see setBudget).
+    bool run() {
+        if (incremental && (algorithm != GNFAlgorithm::Substitution || pruning)) {
+            std::cerr << "Incremental mode uses the substitution algorithm without pruning." << std::endl;
+            algorithm = GNFAlgorithm::Substitution;
+            pruning = false;
+        }
+        if (!spillDirectory.empty() && (incremental || pruning)) {
+            std::cerr << "Spilling is off in incremental mode and with pruning." << std::endl;
+            spillDirectory.clear();
+        }
+        if (!spillDirectory.empty() && !spill.open(spillDirectory)) return false;
+        aborted = false;
+        if (incremental) source = materialize();
+        if (algorithm == GNFAlgorithm::LeftCorner || algorithm == GNFAlgorithm::Matrix) {
+            bool leftCorner = algorithm == GNFAlgorithm::LeftCorner;
+            const char* name = leftCorner ? "left_corner" : "matrix";
+            bool built = false;
+            stage(name, [&]() { built = leftCorner ? leftCornerConstruction() : matrixConstruction(); });
+            if (aborted) return stopped(name);
+            if (built) return true;
+            std::cerr << "Falling back to the substitution algorithm." << std::endl;
+        }
+        stage("ordering", [&]() { step2_Ordering(); });
+        if (pruning) stage("prune_after_ordering", [&]() { pruneUseless("after ordering"); });
+        stage("forward_substitution", [&]() { step3_ForwardSubstitution(); });
+        if (aborted) return stopped("forward_substitution");
+        if (pruning) stage("prune_after_forward_substitution", [&]() { pruneUseless("after forward substitution"); });
+        stage("back_substitution", [&]() { step5_BackSubstitution(); });
+        if (aborted) return stopped("back_substitution");
+        if (pruning) stage("prune_after_back_substitution", [&]() { pruneUseless("after back substitution"); });
+        if (sink && pruning) {
+            for (const auto& pair : materialize()) streamRule(pair.first);
+            sink->flush();
+        }
+        converted = true;
+        return true;
+    }
+
+    bool stopped(const std::string& stageName) {
+        std::cerr << "Error: GNF conversion stopped in " << stageName << " because " << abortReason
+                  << " (" << liveRules.load() << " rules";
+        if (AllocationStats::enabled()) std::cerr << ", " << (AllocationStats::live().load() >> 20) << " MB live";
+        std::cerr << "); the working grammar is incomplete." << std::endl;
+        return false;
+    }
+
+    // Limits for steps 3-5, 0 = none: live heap bytes (as AllocationStats
+    // counts them) and rules in the working grammar. They are checked as
+    // substitution adds rules; past either one, run() stops early, reports
+    // where and why, and returns false, rather than growing until the
+    // process is killed. Heads already streamed to the rule sink are final.
+    void setBudget(size_t bytes, size_t ruleCount) {
+        maxBytes = bytes;
+        maxRules = ruleCount;
+        if (bytes) AllocationStats::enable();
+    }
+    bool budgetExceeded() const { return aborted; }
+
+    // During step 5, each head is written to a temporary file in
+    // 'directory' and dropped from memory once it is final, whenever the
+    // live heap is above 'thresholdBytes' (0: always), and the body nodes
+    // only it used are freed. Later substitutions, the rule sink and
+    // result() read spilled heads back from the file.
+    // Ignored in incremental mode and with pruning, which revisit every head.
+    void setSpill(const std::string& directory, size_t thresholdBytes) {
+        spillDirectory = directory;
+        spillThreshold = thresholdBytes;
+        if (!directory.empty() && thresholdBytes) AllocationStats::enable();
+    }
+
+    void printSpillStats() const {
+        if (!spill.isOpen()) return;
+        std::cout << "  spilled " << spill.heads() << " heads, " << spill.bodies() << " rules, "
+                  << (spill.bytes() >> 20) << " MB" << std::endl;
+    }
+
+    // Incremental maintenance. With setIncremental(true) before run(), the
+    // converter tracks, per variable, which heads steps 3 and 5 substituted
+    // into it. addRule / removeRule then edit the source grammar and redo
+    // the conversion only for the edited head and the heads depending on
+    // it; result() matches a full conversion of the edited grammar (up to
+    // the names of new Z variables). They return false, leaving everything
+    // unchanged, if the rule was already there / was not there.
+    void setIncremental(bool on) { incremental = on; }
+    bool addRule(Symbol head, const ProductionBody& body) { return edit(head, body, true); }
+    bool removeRule(Symbol head, const ProductionBody& body) { return edit(head, body, false); }
+    // Heads whose final rules the last edit recomputed.
+    size_t lastRecomputed() const { return recomputed; }
+    // The start variable of result(): setStartSymbol's, or A_1.
+    Symbol startVariable() { return start(); }
+    // A -> Z_A for every A whose left recursion step 4 removed.
+    const std::unordered_map<Symbol, Symbol>& leftRecursionVariables() const { return zOf; }
+};
 
 // ==========================================
-// Core Data Structures
+// Real-Time GNF Parser
 // ==========================================
 
-enum SymbolType {
-    TERMINAL,
-    VARIABLE
+// Open-addressing set of 64-bit keys for the recognizers' per-step
+// dedup. clear() resets only the slots used since the last clear, so a
+// set that is cleared every step costs nothing per step when it stays
+// small. ~0 is reserved as the empty slot.
+class KeySet {
+private:
+    static const uint64_t EMPTY = ~uint64_t(0);
+    std::vector<uint64_t> slots;
+    std::vector<size_t> used;
+
+    static size_t slotOf(uint64_t key, size_t mask) {
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDULL;
+        key ^= key >> 33;
+        return static_cast<size_t>(key) & mask;
+    }
+
+    void grow() {
+        std::vector<uint64_t> keys;
+        for (size_t i : used) keys.push_back(slots[i]);
+        slots.assign(slots.empty() ? 256 : slots.size() * 2, EMPTY);
+        used.clear();
+        for (uint64_t key : keys) insert(key);
+    }
+
+public:
+    // False if 'key' was already in the set.
+    bool insert(uint64_t key) {
+        if ((used.size() + 1) * 2 > slots.size()) grow();
+        size_t mask = slots.size() - 1;
+        size_t i = slotOf(key, mask);
+        for (; slots[i] != EMPTY; i = (i + 1) & mask) {
+            if (slots[i] == key) return false;
+        }
+        slots[i] = key;
+        used.push_back(i);
+        return true;
+    }
+
+    void clear() {
+        for (size_t i : used) slots[i] = EMPTY;
+        used.clear();
+    }
 };
 
-// Represents Terminals and Variables.
-struct Symbol {
-    std::string name;
-    SymbolType type;
-    int index; // Used for the A_i ordering constraint.
+const uint64_t KeySet::EMPTY;
 
-    // Comparison for std::map and std::set keys
-    bool operator<(const Symbol& other) const {
-        if (type != other.type) return type < other.type;
-        if (name != other.name) return name < other.name;
-        return index < other.index;
+// Recognizer for a grammar in GNF, consuming exactly one terminal per step.
+// A configuration is the stack of symbols still to be derived; reading c
+// with X on top replaces X by the tail beta of each X -> c beta. Bodies are
+// indexed by (head, first terminal), so that lookup is one hash probe.
+//
+// Nondeterminism is handled by stepping every configuration at once, over
+// a graph-structured stack local to the call, Tomita style. A node is one
+// variable X expanded at input position p: every configuration with X on
+// top at p shares it, and keeps what lay below X as its below edges. A
+// configuration is (node, position in a body tail of X). Tails are stored
+// as a suffix-shared trie, so bodies ending alike share positions, and a
+// step costs one edge per configuration plus one configuration per
+// (expanded X, tail) rather than their product. The set stays polynomial in
+// the input length even when the number of distinct stacks is exponential.
+//
+// build() is the only mutating call; recognize() is const and keeps its
+// state on the stack, so one parser can serve many threads.
+class GNFParser {
+private:
+    // The tails of every X -> c beta with one (X, c), as entry positions.
+    struct Range { uint32_t begin, end; bool completes; }; // completes: X -> c itself
+    struct Config {
+        uint32_t node, position;
+        bool operator==(const Config& o) const { return node == o.node && position == o.position; }
+    };
+    struct Node { std::vector<Config> below; };
+
+    static const uint32_t BOTTOM = 0xFFFFFFFFu; // Config node of the empty stack
+    static const uint32_t END = 0;              // Position past the last symbol of a tail
+
+    std::unordered_map<uint64_t, uint32_t> index; // (X, c) -> range
+    std::vector<Range> ranges;
+    std::vector<uint32_t> entries;
+    std::vector<Symbol> symbolAt;  // Tail trie, by position: the symbol there
+    std::vector<uint32_t> nextOf;  // ... and the position after it
+    uint32_t startPosition = 0;    // Pseudo-tail that is just the start symbol
+    bool acceptsEmpty = false;
+
+    static uint64_t keyOf(Symbol head, Symbol terminal) { return (static_cast<uint64_t>(head.id) << 32) | terminal.id; }
+
+    // Position of 'sym' followed by the tail at 'next', shared by every
+    // tail with that suffix.
+    uint32_t positionOf(Symbol sym, uint32_t next, std::unordered_map<uint64_t, uint32_t>& trie) {
+        auto found = trie.emplace((static_cast<uint64_t>(sym.id) << 32) | next, static_cast<uint32_t>(symbolAt.size()));
+        if (found.second) {
+            symbolAt.push_back(sym);
+            nextOf.push_back(next);
+        }
+        return found.first->second;
+    }
+
+public:
+    // Per-call counters, for benchmarks.
+    struct Stats {
+        size_t peakConfigurations = 0;
+        size_t stackNodes = 0;
+    };
+
+    // Returns false (with a diagnostic) unless every body starts with a
+    // terminal; the only empty body allowed is start -> epsilon, and then
+    // start may not appear in any body.
+    bool build(const Grammar& G, Symbol start) {
+        index.clear();
+        ranges.clear();
+        entries.clear();
+        symbolAt.assign(1, Symbol{0});
+        nextOf.assign(1, END);
+        acceptsEmpty = false;
+
+        std::map<uint64_t, std::vector<ProductionBody>> byKey;
+        bool startUsed = false;
+        for (const auto& pair : G) {
+            for (const auto& body : pair.second) {
+                if (body.empty()) {
+                    if (pair.first != start) {
+                        std::cerr << "Error: " << pair.first.name() << " -> epsilon; only the start symbol may derive epsilon." << std::endl;
+                        return false;
+                    }
+                    acceptsEmpty = true;
+                    continue;
+                }
+                if (body.front().type() != TERMINAL) {
+                    std::cerr << "Error: a body of " << pair.first.name() << " starts with " << body.front().name()
+                              << "; the grammar is not in GNF." << std::endl;
+                    return false;
+                }
+                for (Symbol sym : body) startUsed = startUsed || sym == start;
+                byKey[keyOf(pair.first, body.front())].push_back(body);
+            }
+        }
+        if (acceptsEmpty && startUsed) {
+            std::cerr << "Error: start -> epsilon with the start symbol in a body." << std::endl;
+            return false;
+        }
+
+        std::unordered_map<uint64_t, uint32_t> trie;
+        SmallVector<Symbol, 16> tail;
+        for (const auto& entry : byKey) {
+            Range range = {static_cast<uint32_t>(entries.size()), 0, false};
+            for (const auto& body : entry.second) {
+                tail.clear();
+                for (Symbol sym : body.tail()) tail.push_back(sym);
+                uint32_t position = END;
+                for (size_t i = tail.size(); i-- > 0;) position = positionOf(tail.begin()[i], position, trie);
+                if (position == END) {
+                    range.completes = true;
+                } else {
+                    entries.push_back(position);
+                }
+            }
+            std::sort(entries.begin() + range.begin, entries.end());
+            entries.erase(std::unique(entries.begin() + range.begin, entries.end()), entries.end());
+            range.end = static_cast<uint32_t>(entries.size());
+            index[entry.first] = static_cast<uint32_t>(ranges.size());
+            ranges.push_back(range);
+        }
+        startPosition = positionOf(start, END, trie);
+        return true;
     }
 
-    bool operator==(const Symbol& other) const {
-        return name == other.name && type == other.type && index == other.index;
+    // Incremental recognition, one terminal at a time, for callers that
+    // walk many inputs sharing prefixes: push() extends the input by one
+    // terminal, pop() takes back the last push(). A step only appends
+    // nodes and adds below edges to nodes it created, so popping is
+    // truncation.
+    class Run {
+    private:
+        friend class GNFParser;
+        std::vector<Node> nodes;                 // The first nodeCount are live; the rest are kept for reuse
+        std::vector<std::vector<Config>> levels; // Configuration set per prefix length, reused
+        std::vector<size_t> nodeMarks;           // nodeCount before each push
+        size_t nodeCount = 0;
+        size_t depth = 0;
+        std::vector<uint32_t> expandedNode;      // Range -> node expanded in this step,
+        std::vector<uint64_t> expandedStep;      // valid where expandedStep == step
+        uint64_t step = 0;
+        KeySet inNext;
+        std::vector<Config> work;
+        size_t peak = 0;
+
+    public:
+        size_t length() const { return depth; }
+        // False once no extension of the input can be accepted.
+        bool alive() const { return !levels[depth].empty(); }
+    };
+
+    void start(Run& run) const {
+        run.nodes.assign(1, Node{std::vector<Config>(1, Config{BOTTOM, END})});
+        run.nodeCount = 1;
+        if (run.levels.empty()) run.levels.emplace_back();
+        run.levels[0].assign(1, Config{0, startPosition});
+        run.nodeMarks.clear();
+        run.depth = 0;
+        run.peak = 1;
+        run.expandedNode.resize(ranges.size());
+        run.expandedStep.assign(ranges.size(), 0);
+        run.step = 0;
     }
-    
-    bool operator!=(const Symbol& other) const {
-        return !(*this == other);
+
+    // Returns run.alive() after the step.
+    bool push(Run& run, Symbol c) const {
+        run.nodeMarks.push_back(run.nodeCount);
+        if (++run.depth == run.levels.size()) run.levels.emplace_back();
+        const std::vector<Config>& current = run.levels[run.depth - 1];
+        std::vector<Config>& next = run.levels[run.depth];
+        next.clear();
+        std::vector<Node>& nodes = run.nodes;
+        run.inNext.clear();
+        run.step++;
+
+        // Adds 'c' to the next set. A config past the end of its tail is
+        // popped right away: it stands for everything below its node.
+        auto add = [&](Config c) {
+            run.work.assign(1, c);
+            while (!run.work.empty()) {
+                Config x = run.work.back();
+                run.work.pop_back();
+                if (!run.inNext.insert((static_cast<uint64_t>(x.node) << 32) | x.position)) continue;
+                if (x.node != BOTTOM && x.position == END) {
+                    const std::vector<Config>& below = nodes[x.node].below;
+                    run.work.insert(run.work.end(), below.begin(), below.end());
+                } else {
+                    next.push_back(x);
+                }
+            }
+        };
+
+        for (const Config& config : current) {
+            if (config.node == BOTTOM) continue; // Empty stack, input left over
+            Symbol top = symbolAt[config.position];
+            const Config rest = {config.node, nextOf[config.position]};
+            if (top.type() == TERMINAL) {
+                if (top == c) add(rest);
+                continue;
+            }
+            auto found = index.find(keyOf(top, c));
+            if (found == index.end()) continue;
+            const uint32_t r = found->second;
+            const Range& range = ranges[r];
+            if (range.completes) add(rest);
+            if (range.begin == range.end) continue;
+
+            // The first config with X on top creates X's node and its
+            // configs; the rest only add below edges. Configs are
+            // distinct, and so are their rests (the trie shares equal
+            // suffixes), so the edges never repeat.
+            if (run.expandedStep[r] != run.step) {
+                run.expandedStep[r] = run.step;
+                run.expandedNode[r] = static_cast<uint32_t>(run.nodeCount);
+                if (run.nodeCount == nodes.size()) nodes.emplace_back();
+                nodes[run.nodeCount++].below.clear();
+                for (uint32_t e = range.begin; e < range.end; e++) add(Config{run.expandedNode[r], entries[e]});
+            }
+            nodes[run.expandedNode[r]].below.push_back(rest);
+        }
+        run.peak = std::max(run.peak, next.size());
+        return !next.empty();
     }
 
-    std::string toString() const {
-        return name;
+    void pop(Run& run) const {
+        run.nodeCount = run.nodeMarks.back();
+        run.nodeMarks.pop_back();
+        run.depth--;
+    }
+
+    bool accepts(const Run& run) const {
+        if (run.length() == 0) return acceptsEmpty;
+        const std::vector<Config>& last = run.levels[run.depth];
+        return std::find(last.begin(), last.end(), Config{BOTTOM, END}) != last.end();
+    }
+
+    bool recognize(const Symbol* input, size_t n, Stats* stats = nullptr) const {
+        Run run;
+        start(run);
+        for (size_t pos = 0; pos < n && push(run, input[pos]); pos++) {}
+        bool accepted = run.length() == n && accepts(run);
+
+        if (stats) {
+            stats->peakConfigurations = std::max(stats->peakConfigurations, run.peak);
+            stats->stackNodes += run.nodeCount;
+        }
+        return accepted;
     }
 };
 
-// Use std::list for production bodies to enable O(1) splicing during substitution.
-using ProductionBody = std::list<Symbol>;
+const uint32_t GNFParser::BOTTOM;
+const uint32_t GNFParser::END;
 
-// Use std::set to automatically filter duplicate rules and keep them sorted.
-using Productions = std::set<ProductionBody>;
+// CYK over a CNF Grammar (A -> B C | a), the baseline for GNFParser.
+// Cells are bitsets over the variables.
+class CYKRecognizer {
+private:
+    struct Binary { uint32_t head, left, right; };
 
-// Map Variables to their set of productions.
-using Grammar = std::map<Symbol, Productions>;
+    size_t words = 0;
+    std::unordered_map<Symbol, uint32_t> slot;
+    std::unordered_map<Symbol, std::vector<uint64_t>> byTerminal;
+    std::vector<Binary> binaries;
+    uint32_t startSlot = 0;
 
-// ==========================================
-// Helper Functions
-// ==========================================
+    static bool has(const uint64_t* set, uint32_t v) { return (set[v >> 6] >> (v & 63)) & 1u; }
 
-void printGrammar(const Grammar& G, const std::string& stageName) {
-    std::cout << "--- " << stageName << " ---" << std::endl;
-    for (const auto& pair : G) {
-        const Symbol& head = pair.first;
-        const Productions& bodies = pair.second;
-        
-        if (bodies.empty()) continue;
-
-        std::cout << head.toString() << " -> ";
-        bool firstBody = true;
-        for (const auto& body : bodies) {
-            if (!firstBody) std::cout << " | ";
-            
-            bool firstSym = true;
-            for (const auto& sym : body) {
-                // Add space between symbols for readability (e.g. "A2 A3" vs "A2A3")
-                // Terminals might not need space if we want compact "a", but "a A1" looks better.
-                if (!firstSym) std::cout << " "; 
-                std::cout << sym.toString();
-                firstSym = false;
+public:
+    bool build(const Grammar& G, Symbol start) {
+        slot.clear();
+        byTerminal.clear();
+        binaries.clear();
+        for (const auto& pair : G) slot.emplace(pair.first, static_cast<uint32_t>(slot.size()));
+        if (!slot.count(start)) {
+            std::cerr << "Error: start symbol " << start.name() << " has no rules." << std::endl;
+            return false;
+        }
+        startSlot = slot[start];
+        words = (slot.size() + 63) / 64;
+
+        for (const auto& pair : G) {
+            uint32_t A = slot[pair.first];
+            for (const auto& body : pair.second) {
+                if (body.size() == 1 && body.front().type() == TERMINAL) {
+                    std::vector<uint64_t>& set = byTerminal[body.front()];
+                    set.resize(words, 0);
+                    set[A >> 6] |= uint64_t(1) << (A & 63);
+                } else if (body.size() == 2 && body.front().type() == VARIABLE && body.tail().front().type() == VARIABLE &&
+                           slot.count(body.front()) && slot.count(body.tail().front())) {
+                    binaries.push_back({A, slot[body.front()], slot[body.tail().front()]});
+                } else if (body.size() != 2) {
+                    std::cerr << "Error: a body of " << pair.first.name() << " is not in CNF." << std::endl;
+                    return false;
+                }
+                // A -> B C with B or C undefined derives nothing; dropped.
             }
-            firstBody = false;
         }
-        std::cout << std::endl;
+        return true;
     }
-    std::cout << "--------------------------------" << std::endl << std::endl;
-}
+
+    bool recognize(const Symbol* input, size_t n) const {
+        if (n == 0) return false;
+        // table[((len - 1) * n + i) * words] = variables deriving input[i, i + len)
+        std::vector<uint64_t> table(n * n * words, 0);
+        auto cell = [&](size_t len, size_t i) { return &table[((len - 1) * n + i) * words]; };
+        for (size_t i = 0; i < n; i++) {
+            auto found = byTerminal.find(input[i]);
+            if (found == byTerminal.end()) return false;
+            std::copy(found->second.begin(), found->second.end(), cell(1, i));
+        }
+        for (size_t len = 2; len <= n; len++) {
+            for (size_t i = 0; i + len <= n; i++) {
+                uint64_t* out = cell(len, i);
+                for (size_t k = 1; k < len; k++) {
+                    const uint64_t* left = cell(k, i);
+                    const uint64_t* right = cell(len - k, i + k);
+                    for (const Binary& r : binaries) {
+                        if (has(left, r.left) && has(right, r.right)) out[r.head >> 6] |= uint64_t(1) << (r.head & 63);
+                    }
+                }
+            }
+        }
+        return has(cell(n, 0), startSlot);
+    }
+};
 
 // ==========================================
-// GNF Construction Algorithm
+// Bounded Equivalence Check
 // ==========================================
 
-class GNFConverter {
+// Earley recognizer for an arbitrary grammar (epsilon bodies, left
+// recursion and all), the reference side of the equivalence check. Items
+// are (rule, dot, origin). Nullable variables are skipped at prediction
+// time (Aycock & Horspool), so a completion never has to revisit the set
+// it is building.
+//
+// Same incremental interface as GNFParser::Run: set k depends only on
+// sets 0..k, so pop() just drops the last set. Inputs are limited to
+// 65535 terminals.
+class EarleyRecognizer {
 private:
-    Grammar grammar;
-    std::vector<Symbol> orderedVariables;
-    int zCounter = 1;
+    struct Rule { Symbol head; uint32_t begin, length; };
+    struct Item { uint32_t rule, dot, origin; };
 
-    // Checks for immediate left recursion: A -> A alpha
-    bool isLeftRecursive(const Symbol& head, const ProductionBody& body) {
-        return !body.empty() && body.front() == head;
-    }
+    std::vector<Rule> rules;
+    std::vector<Symbol> rhs;
+    std::unordered_map<Symbol, std::vector<uint32_t>> byHead;
+    std::unordered_set<Symbol> nullable;
+    Symbol startSymbol;
+    bool startHasRules = false;
+
+    bool complete(const Item& item) const { return item.dot == rules[item.rule].length; }
+    Symbol nextOf(const Item& item) const { return rhs[rules[item.rule].begin + item.dot]; }
 
 public:
-    GNFConverter(const Grammar& initialGrammar) : grammar(initialGrammar) {}
+    class Run {
+    private:
+        friend class EarleyRecognizer;
+        std::vector<std::vector<Item>> sets; // Reused per prefix length
+        // Per finished set: (next symbol id, item index), sorted, for scans
+        // and completions into that set.
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> waiting;
+        KeySet seen;
+        size_t depth = 0;
 
-    // Step 2: Renaming/Ordering
-    // Collects variables and sorts them (Simulating A_1...A_m assignment)
-    void step2_Ordering() {
-        orderedVariables.clear();
-        for (auto& pair : grammar) {
-            if (pair.first.type == VARIABLE) {
-                orderedVariables.push_back(pair.first);
+    public:
+        size_t length() const { return depth; }
+        bool alive() const { return !sets[depth].empty(); }
+    };
+
+    bool build(const Grammar& G, Symbol start) {
+        rules.clear();
+        rhs.clear();
+        byHead.clear();
+        nullable.clear();
+        startSymbol = start;
+        for (const auto& pair : G) {
+            for (const auto& body : pair.second) {
+                if (body.size() > 0xFFFF) {
+                    std::cerr << "Error: a body of " << pair.first.name() << " is too long for the recognizer." << std::endl;
+                    return false;
+                }
+                byHead[pair.first].push_back(static_cast<uint32_t>(rules.size()));
+                rules.push_back(Rule{pair.first, static_cast<uint32_t>(rhs.size()), static_cast<uint32_t>(body.size())});
+                for (Symbol sym : body) rhs.push_back(sym);
             }
         }
-        // Sort based on index
-        std::sort(orderedVariables.begin(), orderedVariables.end(), [](const Symbol& a, const Symbol& b){
-            return a.index < b.index;
-        });
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const Rule& rule : rules) {
+                if (nullable.count(rule.head)) continue;
+                bool all = true;
+                for (uint32_t k = 0; k < rule.length && all; k++) all = nullable.count(rhs[rule.begin + k]) > 0;
+                if (all) changed = nullable.insert(rule.head).second;
+            }
+        }
+        // A start symbol without rules (none given, or all pruned) derives
+        // nothing: every run starts dead.
+        startHasRules = byHead.count(start) > 0;
+        return true;
+    }
 
-        printGrammar(grammar, "Step 2: Variables Ordered");
+private:
+    void add(Run& run, const Item& item) const {
+        uint64_t key = (static_cast<uint64_t>(item.rule) << 32) | (item.dot << 16) | item.origin;
+        if (run.seen.insert(key)) run.sets[run.depth].push_back(item);
     }
 
-    // Step 3: Lemma 1 & Forward Substitution
-    // Transform rules so that if A_i -> A_j alpha, then j > i.
-    void step3_ForwardSubstitution() {
-        for (size_t i = 0; i < orderedVariables.size(); ++i) {
-            Symbol Ai = orderedVariables[i];
-            
-            for (size_t j = 0; j < i; ++j) {
-                Symbol Aj = orderedVariables[j];
-
-                Productions newRules;
-                Productions& aiRules = grammar[Ai];
-                
-                auto it = aiRules.begin();
-                while (it != aiRules.end()) {
-                    ProductionBody currentBody = *it;
-                    
-                    // Detect A_i -> A_j alpha
-                    if (!currentBody.empty() && currentBody.front() == Aj) {
-                        std::list<Symbol> alpha = currentBody; 
-                        alpha.pop_front();
-
-                        // Substitute A_j with its bodies
-                        if (grammar.find(Aj) != grammar.end()) {
-                            const Productions& ajRules = grammar.at(Aj);
-                            for (const auto& beta : ajRules) {
-                                ProductionBody newBody = beta;
-                                std::list<Symbol> alphaCopy = alpha; 
-                                newBody.splice(newBody.end(), alphaCopy);
-                                newRules.insert(newBody);
-                            }
-                        }
-                        it = aiRules.erase(it);
-                    } else {
-                        ++it;
+    // Predicts and completes until the current set is closed, then indexes
+    // it by next symbol.
+    void close(Run& run) const {
+        std::vector<Item>& set = run.sets[run.depth];
+        for (size_t k = 0; k < set.size(); k++) {
+            const Item item = set[k];
+            if (complete(item)) {
+                Symbol head = rules[item.rule].head;
+                if (item.origin == run.depth) {
+                    for (size_t j = 0; j < k; j++) {
+                        if (!complete(set[j]) && nextOf(set[j]) == head) add(run, Item{set[j].rule, set[j].dot + 1, set[j].origin});
                     }
+                    continue;
+                }
+                const std::vector<Item>& from = run.sets[item.origin];
+                const auto& index = run.waiting[item.origin];
+                auto range = std::equal_range(index.begin(), index.end(), std::make_pair(head.id, 0u),
+                    [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) { return a.first < b.first; });
+                for (auto it = range.first; it != range.second; ++it) {
+                    const Item& parent = from[it->second];
+                    add(run, Item{parent.rule, parent.dot + 1, parent.origin});
                 }
-                aiRules.insert(newRules.begin(), newRules.end());
+                continue;
             }
-            eliminateLeftRecursion(Ai);
+            Symbol next = nextOf(item);
+            if (next.type() != VARIABLE) continue;
+            auto found = byHead.find(next);
+            if (found != byHead.end()) {
+                for (uint32_t r : found->second) add(run, Item{r, 0, static_cast<uint32_t>(run.depth)});
+            }
+            if (nullable.count(next)) add(run, Item{item.rule, item.dot + 1, item.origin});
+        }
+
+        if (run.waiting.size() <= run.depth) run.waiting.resize(run.depth + 1);
+        auto& index = run.waiting[run.depth];
+        index.clear();
+        for (size_t k = 0; k < set.size(); k++) {
+            if (!complete(set[k])) index.push_back(std::make_pair(nextOf(set[k]).id, static_cast<uint32_t>(k)));
         }
-        printGrammar(grammar, "Step 3: Forward Substitution & Recursion Elimination");
+        std::sort(index.begin(), index.end());
     }
 
-    // Step 4: Eliminate Immediate Left Recursion
-    // Transforms A -> A alpha | beta  into  A -> beta Z?, Z -> alpha Z?
-    void eliminateLeftRecursion(Symbol A) {
-        Productions& rules = grammar[A];
-        Productions alphaRules; 
-        Productions betaRules;
+public:
+    void start(Run& run) const {
+        run.depth = 0;
+        if (run.sets.empty()) run.sets.emplace_back();
+        run.sets[0].clear();
+        run.seen.clear();
+        if (startHasRules) {
+            for (uint32_t r : byHead.at(startSymbol)) add(run, Item{r, 0, 0});
+        }
+        close(run);
+    }
 
-        bool hasRecursive = false;
-        for (const auto& body : rules) {
-            if (isLeftRecursive(A, body)) {
-                hasRecursive = true;
-                ProductionBody alpha = body;
-                alpha.pop_front();
-                alphaRules.insert(alpha);
-            } else {
-                betaRules.insert(body);
-            }
+    bool push(Run& run, Symbol c) const {
+        if (++run.depth == run.sets.size()) run.sets.emplace_back();
+        run.sets[run.depth].clear();
+        run.seen.clear();
+        const std::vector<Item>& previous = run.sets[run.depth - 1];
+        const auto& index = run.waiting[run.depth - 1];
+        auto range = std::equal_range(index.begin(), index.end(), std::make_pair(c.id, 0u),
+            [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) { return a.first < b.first; });
+        for (auto it = range.first; it != range.second; ++it) {
+            const Item& item = previous[it->second];
+            add(run, Item{item.rule, item.dot + 1, item.origin});
         }
+        close(run);
+        return run.alive();
+    }
 
-        if (!hasRecursive) return;
+    void pop(Run& run) const { run.depth--; }
 
-        // Create new Variable Z
-        Symbol Z;
-        Z.name = "Z_" + A.name;
-        Z.type = VARIABLE;
-        Z.index = 1000 + zCounter++; 
-        
-        rules.clear();
+    bool accepts(const Run& run) const {
+        for (const Item& item : run.sets[run.depth]) {
+            if (item.origin == 0 && complete(item) && rules[item.rule].head == startSymbol) return true;
+        }
+        return false;
+    }
+};
 
-        // A -> beta | beta Z
-        for (const auto& beta : betaRules) {
-            rules.insert(beta); 
-            
-            ProductionBody betaZ = beta;
-            betaZ.push_back(Z);
-            rules.insert(betaZ); 
+struct EquivalenceReport {
+    size_t strings = 0;        // Strings decided by both recognizers
+    size_t accepted = 0;       // ... accepted by both
+    size_t deadPrefixes = 0;   // Prefixes that neither grammar can extend to a word
+    size_t mismatches = 0;
+    std::vector<std::string> examples; // The first few mismatches
+    double seconds = 0;
+};
+
+// Checks that a grammar and its GNF conversion agree on every string of
+// length <= N over their terminals. Strings are walked as a prefix tree,
+// with an Earley run on the original and a GNFParser run on the GNF
+// pushed and popped along the way, so each prefix is parsed once. A
+// subtree is cut as soon as neither run is alive, which keeps sparse
+// languages far below |terminals|^N strings.
+//
+// The first levels of the tree are split into work-stealing tasks, one per
+// prefix, each with its own runs.
+class EquivalenceChecker {
+private:
+    EarleyRecognizer original;
+    GNFParser converted;
+    std::vector<Symbol> alphabet;
+    size_t maxLength = 0;
+    size_t splitDepth = 0;
+    std::mutex reportLock;
+    EquivalenceReport report;
+
+    static const size_t MAX_EXAMPLES = 10;
+
+    struct Walk {
+        EarleyRecognizer::Run left;
+        GNFParser::Run right;
+        std::vector<Symbol> prefix;
+        EquivalenceReport counts;
+    };
+
+    std::string spell(const std::vector<Symbol>& word) const {
+        if (word.empty()) return "epsilon";
+        bool single = true;
+        for (Symbol sym : word) single = single && sym.name().size() == 1;
+        std::string out;
+        for (Symbol sym : word) out += (out.empty() || single ? "" : " ") + sym.name();
+        return out;
+    }
+
+    // Decides walk.prefix, then every extension of it (up to splitDepth
+    // when 'spawn' is set, where the subtrees become tasks instead).
+    void visit(Walk& walk, WorkStealingPool* spawn) {
+        bool inOriginal = original.accepts(walk.left);
+        bool inConverted = converted.accepts(walk.right);
+        walk.counts.strings++;
+        walk.counts.accepted += inOriginal && inConverted;
+        if (inOriginal != inConverted) {
+            walk.counts.mismatches++;
+            std::lock_guard<std::mutex> guard(reportLock);
+            if (report.examples.size() < MAX_EXAMPLES) {
+                report.examples.push_back(spell(walk.prefix) + (inOriginal ? "  (only in the original)" : "  (only in the GNF)"));
+            }
+        }
+        if (walk.prefix.size() == maxLength) return;
+        if (!walk.left.alive() && !walk.right.alive()) {
+            walk.counts.deadPrefixes++;
+            return;
+        }
+        if (spawn && walk.prefix.size() < splitDepth) {
+            for (Symbol c : alphabet) {
+                std::vector<Symbol> child = walk.prefix;
+                child.push_back(c);
+                spawn->submit([this, child, spawn]() { explore(child, spawn); });
+            }
+            return;
+        }
+        for (Symbol c : alphabet) {
+            walk.prefix.push_back(c);
+            original.push(walk.left, c);
+            converted.push(walk.right, c);
+            visit(walk, nullptr);
+            converted.pop(walk.right);
+            original.pop(walk.left);
+            walk.prefix.pop_back();
         }
+    }
 
-        // Z -> alpha | alpha Z
-        Productions zRules;
-        for (const auto& alpha : alphaRules) {
-            zRules.insert(alpha); 
-            
-            ProductionBody alphaZ = alpha;
-            alphaZ.push_back(Z);
-            zRules.insert(alphaZ);
+    // Task body: replays 'prefix' into fresh runs and visits it.
+    void explore(const std::vector<Symbol>& prefix, WorkStealingPool* pool) {
+        Walk walk;
+        original.start(walk.left);
+        converted.start(walk.right);
+        for (Symbol c : prefix) {
+            walk.prefix.push_back(c);
+            original.push(walk.left, c);
+            converted.push(walk.right, c);
         }
+        visit(walk, pool);
 
-        grammar[Z] = zRules;
+        std::lock_guard<std::mutex> guard(reportLock);
+        report.strings += walk.counts.strings;
+        report.accepted += walk.counts.accepted;
+        report.deadPrefixes += walk.counts.deadPrefixes;
+        report.mismatches += walk.counts.mismatches;
     }
 
-    // Step 5: Back Substitution
-    // Ensure all rules start with a Terminal by propagating backwards from A_m to A_1.
-    void step5_BackSubstitution() {
-        // Process original variables backwards
-        for (int i = orderedVariables.size() - 1; i >= 0; --i) {
-            Symbol Ai = orderedVariables[i];
-            substituteUntilTerminal(Ai);
+public:
+    // 'converted' must be in GNF (see GNFParser::build).
+    bool build(const Grammar& originalGrammar, const Grammar& convertedGrammar, Symbol start) {
+        if (!original.build(originalGrammar, start) || !converted.build(convertedGrammar, start)) return false;
+        std::set<Symbol> terminals;
+        for (const Grammar* G : {&originalGrammar, &convertedGrammar}) {
+            for (const auto& pair : *G) {
+                for (const auto& body : pair.second) {
+                    for (Symbol sym : body) {
+                        if (sym.type() == TERMINAL) terminals.insert(sym);
+                    }
+                }
+            }
+        }
+        alphabet.assign(terminals.begin(), terminals.end());
+        return true;
+    }
+
+    // Returns true if the languages agree up to 'length'; 'out' gets the
+    // counts and up to ten counterexamples. threads = 0 uses every core.
+    bool check(size_t length, unsigned threads, EquivalenceReport& out) {
+        if (length > 0xFFFF) length = 0xFFFF;
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        maxLength = length;
+        report = EquivalenceReport();
+
+        // Enough first-level tasks to keep every thread busy while
+        // subtrees of very different sizes are stolen around.
+        splitDepth = 0;
+        for (size_t tasks = 1; tasks < 16 * threads && splitDepth < maxLength && alphabet.size() > 1; tasks *= alphabet.size()) {
+            splitDepth++;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        {
+            WorkStealingPool pool(threads);
+            pool.submit([this, &pool]() { explore(std::vector<Symbol>(), &pool); });
+            pool.wait();
         }
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        out = report;
+        return report.mismatches == 0;
+    }
+};
+
+// ==========================================
+// Benchmark
+// ==========================================
+
+// Grammar family whose GNF grows exponentially in m: A_i leads with both
+// A_{i+1} and A_{i+2}, so back substitution gives A_i at least
+// |A_{i+1}| + |A_{i+2}| bodies, each about as long as the chain below it.
+// A_m -> A_1 A_1 also forces left-recursion elimination through step 3.
+// m = 10 reaches ~600k symbols in the final grammar, m = 12 ~5 million.
+Grammar makeBenchmarkGrammar(int m) {
+    std::vector<Symbol> A(m + 1);
+    for (int i = 1; i <= m; i++) A[i] = symbols().intern("A" + std::to_string(i), VARIABLE, i);
+    Symbol a = symbols().intern("a", TERMINAL);
+    Symbol b = symbols().intern("b", TERMINAL);
+
+    Grammar G;
+    for (int i = 1; i <= m - 2; i++) {
+        G[A[i]].insert({A[i + 1], A[i + 1]});
+        G[A[i]].insert({A[i + 2], A[i + 2]});
+        G[A[i]].insert({a});
+    }
+    G[A[m - 1]].insert({A[m], A[m]});
+    G[A[m - 1]].insert({a});
+    G[A[m]].insert({A[1], A[1]});
+    G[A[m]].insert({b});
+    return G;
+}
+
+// Random CNF grammar over {a, b}: every A_i has one terminal rule and one to
+// three A_i -> A_j A_k rules. Even small m can make substitution explode.
+Grammar makeRandomGrammar(int m, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<Symbol> A(m + 1);
+    for (int i = 1; i <= m; i++) A[i] = symbols().intern("A" + std::to_string(i), VARIABLE, i);
+    Symbol terminals[2] = {symbols().intern("a", TERMINAL), symbols().intern("b", TERMINAL)};
+
+    Grammar G;
+    for (int i = 1; i <= m; i++) {
+        int binaries = 1 + rng() % 3;
+        for (int k = 0; k < binaries; k++) G[A[i]].insert({A[1 + rng() % m], A[1 + rng() % m]});
+        G[A[i]].insert({terminals[rng() % 2]});
+    }
+    return G;
+}
+
+struct BenchOptions {
+    std::ostream* stats = nullptr;
+    std::string output;       // Final grammar, streamed while converting
+    bool splitOutput = false; // One output file per conversion
+    GrammarWriter::Format format = GrammarWriter::TEXT;
+    unsigned threads = 1;
+    bool prune = false;
+    bool random = false;
+    unsigned seed = 1;
+    std::vector<GNFAlgorithm> algorithms = {GNFAlgorithm::Substitution};
+    size_t maxBytes = 0;
+    size_t maxRules = 0;
+    std::string spillDirectory;
+    size_t spillThreshold = 0;
+};
+
+// Fixed width, so that --compare lines up.
+const char* algorithmLabel(GNFAlgorithm algorithm) {
+    switch (algorithm) {
+    case GNFAlgorithm::LeftCorner: return "left-corner ";
+    case GNFAlgorithm::Matrix:     return "matrix      ";
+    default:                       return "substitution";
+    }
+}
 
-        // Process Z variables (they might still point to Variables)
-        // We collect them first to avoid iterator invalidation or logic issues
-        std::vector<Symbol> zVars;
-        for (auto& pair : grammar) {
-            bool isOriginal = false;
-            for(auto &v : orderedVariables) if(v == pair.first) isOriginal = true;
-            if (!isOriginal) zVars.push_back(pair.first);
+// --output names the file itself when the run converts a single grammar;
+// otherwise each conversion gets "<file>.<m>.<algorithm>", so that no file
+// holds more than one grammar (or binary header).
+std::string outputPath(const BenchOptions& options, int m, GNFAlgorithm algorithm) {
+    if (!options.splitOutput) return options.output;
+    std::string label = algorithmLabel(algorithm);
+    label.erase(label.find_last_not_of(' ') + 1);
+    return options.output + "." + std::to_string(m) + "." + label;
+}
+
+void runBenchmark(int m, const BenchOptions& options) {
+    Grammar G = options.random ? makeRandomGrammar(m, options.seed) : makeBenchmarkGrammar(m);
+    for (GNFAlgorithm algorithm : options.algorithms) {
+        GNFConverter converter(G);
+        converter.setVerbose(false);
+        converter.setThreads(options.threads);
+        converter.setPruning(options.prune);
+        converter.setAlgorithm(algorithm);
+        converter.setStatsStream(options.stats);
+        converter.setBudget(options.maxBytes, options.maxRules);
+        if (!options.spillDirectory.empty()) converter.setSpill(options.spillDirectory, options.spillThreshold);
+        std::unique_ptr<FILE, int (*)(FILE*)> file(nullptr, std::fclose);
+        std::unique_ptr<GrammarWriter> writer;
+        if (!options.output.empty()) {
+            std::string path = outputPath(options, m, algorithm);
+            file.reset(std::fopen(path.c_str(), "wb"));
+            if (!file) {
+                std::cerr << "Error: cannot open " << path << std::endl;
+                continue;
+            }
+            writer.reset(new GrammarWriter(file.get(), options.format));
+            converter.setRuleSink(writer.get());
         }
-        
-        for (const auto& Z : zVars) {
-            substituteUntilTerminal(Z);
+
+        size_t nodesBefore = bodyStore().nodeCount();
+        auto begin = std::chrono::steady_clock::now();
+        bool finished = converter.run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (!finished) {
+            std::cout << "m=" << m << "  "
+                      << algorithmLabel(algorithm) << "  stopped after " << seconds << "s" << std::endl;
+            continue;
         }
 
-        printGrammar(grammar, "Step 5: Back Substitution (Final GNF)");
+        std::pair<size_t, size_t> size = converter.ruleAndSymbolCount();
+        std::cout << "m=" << m << "  "
+                  << algorithmLabel(algorithm)
+                  << "  variables=" << converter.variableCount()
+                  << "  productions=" << size.first << "  symbols=" << size.second
+                  << "  shared nodes=" << bodyStore().nodeCount() - nodesBefore
+                  << "  time=" << seconds << "s" << std::endl;
+        if (options.prune) converter.printPruneStats();
+        converter.printSpillStats();
     }
+}
 
-    // Helper to substitute the head of productions until they start with a Terminal
-    void substituteUntilTerminal(Symbol target) {
-        Productions& rules = grammar[target];
-        Productions newRules;
-        
-        auto it = rules.begin();
-        while (it != rules.end()) {
-            if (!it->empty() && it->front().type == VARIABLE) {
-                Symbol first = it->front();
-                ProductionBody suffix = *it; 
-                suffix.pop_front();
-                
-                if (grammar.count(first)) {
-                    for(const auto& repl : grammar.at(first)) {
-                        ProductionBody combined = repl;
-                        // We must copy suffix because we splice it multiple times
-                        std::list<Symbol> suffixCopy = suffix;
-                        combined.splice(combined.end(), suffixCopy);
-                        newRules.insert(combined);
-                    }
+// { a^n b^n } in CNF, as in the CNF simulation: S -> AB | AC, C -> SB,
+// A -> a, B -> b. Unambiguous, so the GNF parser keeps one configuration.
+Grammar makeAnBnGrammar() {
+    Symbol S = symbols().intern("S", VARIABLE, 1);
+    Symbol C = symbols().intern("C", VARIABLE, 2);
+    Symbol A = symbols().intern("A", VARIABLE, 3);
+    Symbol B = symbols().intern("B", VARIABLE, 4);
+    Grammar G;
+    G[S].insert({A, B});
+    G[S].insert({A, C});
+    G[C].insert({S, B});
+    G[A].insert({symbols().intern("a", TERMINAL)});
+    G[B].insert({symbols().intern("b", TERMINAL)});
+    return G;
+}
+
+// Recognizes 'count' strings of each length with GNFParser (on the
+// converted grammar) and with CYK (on the CNF input), checking that both
+// agree. Half of the strings are random over the grammar's terminals, half
+// are derived from the grammar, so both outcomes are exercised.
+void runParseBenchmark(const std::string& name, const Grammar& G, const std::vector<int>& lengths, int count, unsigned seed) {
+    GNFConverter converter(G);
+    converter.setVerbose(false);
+    // The parser's work per step grows with the GNF grammar, so it gets the
+    // polynomial left-corner construction rather than substitution.
+    converter.setAlgorithm(GNFAlgorithm::LeftCorner);
+    if (!converter.run()) return;
+    Symbol start = converter.startVariable();
+
+    GNFParser parser;
+    CYKRecognizer cyk;
+    if (!parser.build(converter.result(), start) || !cyk.build(G, start)) return;
+
+    // Exact-length strings, drawn like CNFGenerator does: count[X][k] is the
+    // number of derivations of X yielding k terminals, and each rule/split
+    // is picked in proportion to the derivations it leads to.
+    std::mt19937 rng(seed);
+    std::vector<Symbol> terminals;
+    const int longest = *std::max_element(lengths.begin(), lengths.end());
+    std::map<Symbol, std::vector<double>> counts;
+    for (const auto& pair : G) counts[pair.first].assign(longest + 1, 0.0);
+    auto countOf = [&](Symbol X, int k) {
+        auto found = counts.find(X);
+        return found == counts.end() ? 0.0 : found->second[k];
+    };
+    for (int k = 1; k <= longest; k++) {
+        for (const auto& pair : G) {
+            double total = 0;
+            for (const auto& body : pair.second) {
+                if (body.size() == 1) {
+                    if (k == 1) total += 1;
+                    if (std::find(terminals.begin(), terminals.end(), body.front()) == terminals.end()) terminals.push_back(body.front());
+                } else {
+                    for (int j = 1; j < k; j++) total += countOf(body.front(), j) * countOf(body.tail().front(), k - j);
+                }
+            }
+            counts[pair.first][k] = total;
+        }
+    }
+    auto derive = [&](int length, std::vector<Symbol>& out) {
+        out.clear();
+        std::vector<std::pair<Symbol, int>> goals(1, std::make_pair(start, length));
+        while (!goals.empty()) {
+            Symbol X = goals.back().first;
+            int k = goals.back().second;
+            goals.pop_back();
+            double pick = std::uniform_real_distribution<double>(0, countOf(X, k))(rng);
+            for (const auto& body : G.at(X)) {
+                if (body.size() == 1) {
+                    if (k != 1) continue;
+                    if ((pick -= 1) < 0) { out.push_back(body.front()); break; }
+                    continue;
+                }
+                Symbol B = body.front(), C = body.tail().front();
+                int j = 1;
+                for (; j < k; j++) {
+                    if ((pick -= countOf(B, j) * countOf(C, k - j)) < 0) break;
+                }
+                if (j < k) {
+                    goals.push_back(std::make_pair(C, k - j));
+                    goals.push_back(std::make_pair(B, j));
+                    break;
                 }
-                it = rules.erase(it);
+            }
+        }
+    };
+
+    for (int length : lengths) {
+        std::vector<std::vector<Symbol>> inputs(count);
+        for (int k = 0; k < count; k++) {
+            if (k % 2 && countOf(start, length) > 0) {
+                derive(length, inputs[k]);
             } else {
-                ++it;
+                for (int i = 0; i < length; i++) inputs[k].push_back(terminals[rng() % terminals.size()]);
             }
         }
-        rules.insert(newRules.begin(), newRules.end());
+
+        GNFParser::Stats stats;
+        std::vector<char> gnfResult(count), cykResult(count);
+        auto begin = std::chrono::steady_clock::now();
+        for (int k = 0; k < count; k++) gnfResult[k] = parser.recognize(inputs[k].data(), inputs[k].size(), &stats);
+        double gnfSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        begin = std::chrono::steady_clock::now();
+        for (int k = 0; k < count; k++) cykResult[k] = cyk.recognize(inputs[k].data(), inputs[k].size());
+        double cykSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        size_t accepted = std::count(gnfResult.begin(), gnfResult.end(), 1);
+        size_t mismatches = 0;
+        for (int k = 0; k < count; k++) mismatches += gnfResult[k] != cykResult[k];
+        std::cout << name << "  length=" << length << "  strings=" << count << "  accepted=" << accepted
+                  << "  gnf=" << gnfSeconds << "s  cyk=" << cykSeconds << "s"
+                  << "  peak configurations=" << stats.peakConfigurations
+                  << "  mismatches=" << mismatches << std::endl;
+    }
+}
+
+// The rules of a converted grammar as sorted "head -> body" lines, with
+// each Z variable written Z_<A> after the A it was made for, so that two
+// conversions that numbered their Zs differently compare equal.
+std::set<std::string> canonicalRules(const Grammar& G, const std::unordered_map<Symbol, Symbol>& zOf) {
+    std::unordered_map<Symbol, std::string> names;
+    for (const auto& pair : zOf) names[pair.second] = "Z_" + pair.first.name();
+    auto nameOf = [&](Symbol X) {
+        auto named = names.find(X);
+        return named != names.end() ? named->second : X.name();
+    };
+    std::set<std::string> lines;
+    for (const auto& pair : G) {
+        for (const auto& body : pair.second) {
+            std::string line = nameOf(pair.first) + " ->";
+            for (Symbol X : body) line += " " + nameOf(X);
+            lines.insert(line);
+        }
     }
+    return lines;
+}
+
+// Applies random rule additions and removals to G through an incremental
+// converter and, after each one, compares its result with a full
+// conversion of the edited grammar. Edits may also give rules to the new
+// variable A<m+1>, and keep every head at one to four rules; an edit
+// whose full conversion outgrows a rule budget is skipped. Returns the number of edits whose results differ.
+size_t runIncrementalCheck(const Grammar& G, int m, unsigned seed, size_t edits) {
+    std::mt19937 rng(seed);
+    std::vector<Symbol> A(m + 2);
+    for (int i = 1; i <= m + 1; i++) A[i] = symbols().intern("A" + std::to_string(i), VARIABLE, i);
+    Symbol terminals[2] = {symbols().intern("a", TERMINAL), symbols().intern("b", TERMINAL)};
+
+    Grammar current = G;
+    GNFConverter converter(G);
+    converter.setVerbose(false);
+    converter.setIncremental(true);
+    if (!converter.run()) return edits;
+
+    const size_t MAX_RULES = 20000;
+    size_t applied = 0, skipped = 0, mismatches = 0, recomputed = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < edits; k++) {
+        Symbol head = A[1 + rng() % (m + 1)];
+        size_t size = current[head].size();
+        bool adding = size < 2 || (size < 4 && rng() % 2);
+        ProductionBody body;
+        if (adding) {
+            body = rng() % 3 ? ProductionBody{A[1 + rng() % (m + 1)], A[1 + rng() % (m + 1)]}
+                             : ProductionBody{terminals[rng() % 2]};
+        } else {
+            auto pick = current[head].begin();
+            std::advance(pick, rng() % current[head].size());
+            body = *pick;
+        }
+        if (adding ? !current[head].insert(body).second : !current[head].erase(body)) continue;
 
-    void run() {
-        step2_Ordering();
-        step3_ForwardSubstitution();
-        step5_BackSubstitution();
+        // Edits that make the grammar blow up are undone before the
+        // incremental converter sees them.
+        GNFConverter full(current);
+        full.setVerbose(false);
+        full.setBudget(0, MAX_RULES);
+        if (!full.run()) {
+            if (adding) {
+                current[head].erase(body);
+            } else {
+                current[head].insert(body);
+            }
+            skipped++;
+            continue;
+        }
+
+        applied++;
+        bool changed = adding ? converter.addRule(head, body) : converter.removeRule(head, body);
+        recomputed += converter.lastRecomputed();
+        std::set<std::string> incrementalRules = canonicalRules(converter.result(), converter.leftRecursionVariables());
+        std::set<std::string> fullRules = canonicalRules(full.result(), full.leftRecursionVariables());
+        if (changed && incrementalRules == fullRules) continue;
+
+        mismatches++;
+        std::cout << "  edit " << k << ": " << (adding ? "add " : "remove ") << head.name() << " ->";
+        for (Symbol X : body) std::cout << " " << X.name();
+        std::cout << std::endl;
+        std::vector<std::string> missing, extra;
+        std::set_difference(fullRules.begin(), fullRules.end(), incrementalRules.begin(), incrementalRules.end(), std::back_inserter(missing));
+        std::set_difference(incrementalRules.begin(), incrementalRules.end(), fullRules.begin(), fullRules.end(), std::back_inserter(extra));
+        if (!missing.empty()) std::cout << "    missing " << missing.front() << " (" << missing.size() << " rules)" << std::endl;
+        if (!extra.empty()) std::cout << "    extra   " << extra.front() << " (" << extra.size() << " rules)" << std::endl;
     }
-};
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << "edits=" << applied << "  skipped=" << skipped << "  recomputed heads per edit=" << (applied ? double(recomputed) / applied : 0.0)
+              << "  mismatches=" << mismatches << "  time=" << seconds << "s" << std::endl;
+    return mismatches;
+}
 
 // ==========================================
 // Main Execution
 // ==========================================
 
-int main() {
+// Usage:
+//   GNF_Example [--quiet] [--stats file] [--grammar file]
+//                                run the step-by-step demo; --quiet skips the grammar
+//                                dumps, --stats appends per-stage JSON lines to file
+//                                ("-" for stdout), --grammar converts a grammar file
+//                                (see Common/GrammarReader.h) instead of the test grammar
+//   GNF_Example --bench [--stats file] [--output file [--binary]] [--threads n] [--prune]
+//                       [--left-corner | --matrix | --compare] [--random seed] [m...]
+//                                convert generated grammars of size m and time them;
+//                                n > 1 runs back substitution in parallel (0 = all cores),
+//                                --prune runs useless-symbol pruning between stages,
+//                                --left-corner uses the polynomial construction instead,
+//                                --matrix uses the matrix method (parallel with --threads),
+//                                --compare runs all three algorithms on each grammar,
+//                                --random uses random CNF grammars instead of the chain family,
+//                                --output streams the final grammar to file (text or binary);
+//                                with several conversions, each goes to file.<m>.<algorithm>
+//                       [--max-memory MB] [--max-rules n] [--spill dir [--spill-threshold MB]]
+//                                --max-memory / --max-rules stop a conversion that outgrows
+//                                them, --spill moves finished heads to a temporary file in
+//                                dir while the live heap is above the threshold (default 0)
+//   GNF_Example --parse-bench [--seed s] [--count k] [--chain m] [length...]
+//                                recognize random and derived strings with the GNF parser
+//                                and with CYK, and compare times; the grammar is a^n b^n,
+//                                or the (highly ambiguous) chain family with --chain
+//   GNF_Example --check [--grammar file | --chain m | --random m seed] [--left-corner | --matrix]
+//                       [--threads n] [--time-limit s] [N]
+//                                convert a grammar (a^n b^n by default) and check that the
+//                                result accepts the same strings of length <= N (default 12),
+//                                on n threads (0 = all cores); exits with 1 on a mismatch,
+//                                or if the check took longer than s seconds
+//   GNF_Example --check-incremental [--random m seed] [--seed s] [N]
+//                                apply N random rule edits (default 200) with addRule /
+//                                removeRule and compare each result with a full conversion
+//                                of the edited grammar; the grammar is random (m = 4 by
+//                                default), s seeds the edits; an edit whose conversion
+//                                outgrows 20000 rules is skipped (with the budget error
+//                                on stderr); exits with 1 on a mismatch
+int main(int argc, char* argv[]) {
+    // --stats is shared by both modes.
+    std::ofstream statsFile;
+    std::ostream* stats = nullptr;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) != "--stats") continue;
+        if (std::string(argv[i + 1]) == "-") {
+            stats = &std::cout;
+        } else {
+            statsFile.open(argv[i + 1], std::ios::app);
+            if (!statsFile) {
+                std::cerr << "Error: cannot open " << argv[i + 1] << std::endl;
+                return 1;
+            }
+            stats = &statsFile;
+        }
+    }
+    // Heap bytes in the stats cover the input grammar too.
+    if (stats) AllocationStats::enable();
+
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        std::vector<int> sizes;
+        BenchOptions options;
+        options.stats = stats;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--stats" && i + 1 < argc) {
+                ++i; // Handled above
+            } else if (arg == "--output" && i + 1 < argc) {
+                options.output = argv[++i];
+            } else if (arg == "--binary") {
+                options.format = GrammarWriter::BINARY;
+            } else if (arg == "--threads" && i + 1 < argc) {
+                options.threads = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--prune") {
+                options.prune = true;
+            } else if (arg == "--left-corner") {
+                options.algorithms = {GNFAlgorithm::LeftCorner};
+            } else if (arg == "--matrix") {
+                options.algorithms = {GNFAlgorithm::Matrix};
+            } else if (arg == "--compare") {
+                options.algorithms = {GNFAlgorithm::Substitution, GNFAlgorithm::LeftCorner, GNFAlgorithm::Matrix};
+            } else if (arg == "--random" && i + 1 < argc) {
+                options.random = true;
+                options.seed = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--max-memory" && i + 1 < argc) {
+                options.maxBytes = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10)) << 20;
+            } else if (arg == "--max-rules" && i + 1 < argc) {
+                options.maxRules = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--spill" && i + 1 < argc) {
+                options.spillDirectory = argv[++i];
+            } else if (arg == "--spill-threshold" && i + 1 < argc) {
+                options.spillThreshold = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10)) << 20;
+            } else {
+                sizes.push_back(std::atoi(argv[i]));
+            }
+        }
+        if (sizes.empty()) sizes = {6, 8, 10, 12};
+        sizes.erase(std::remove_if(sizes.begin(), sizes.end(), [](int m) { return m < 3; }), sizes.end());
+        options.splitOutput = sizes.size() * options.algorithms.size() > 1;
+        for (int m : sizes) runBenchmark(m, options);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--parse-bench") {
+        std::vector<int> lengths;
+        int count = 20;
+        int chain = 0;
+        unsigned seed = 1;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--count" && i + 1 < argc) {
+                count = std::atoi(argv[++i]);
+            } else if (arg == "--seed" && i + 1 < argc) {
+                seed = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--chain" && i + 1 < argc) {
+                chain = std::atoi(argv[++i]);
+            } else {
+                lengths.push_back(std::atoi(argv[i]));
+            }
+        }
+        if (lengths.empty()) lengths = {16, 64, 256};
+        if (count < 1 || (chain && chain < 3)) return 1;
+        if (chain) {
+            runParseBenchmark("chain m=" + std::to_string(chain), makeBenchmarkGrammar(chain), lengths, count, seed);
+        } else {
+            runParseBenchmark("a^n b^n", makeAnBnGrammar(), lengths, count, seed);
+        }
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        Grammar G = makeAnBnGrammar();
+        GNFAlgorithm algorithm = GNFAlgorithm::Substitution;
+        unsigned threads = 0;
+        size_t length = 12;
+        double timeLimit = 0;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--grammar" && i + 1 < argc) {
+                G.clear();
+                if (!loadGrammar(argv[++i], G)) return 1;
+            } else if (arg == "--chain" && i + 1 < argc) {
+                int m = std::atoi(argv[++i]);
+                if (m < 3) return 1;
+                G = makeBenchmarkGrammar(m);
+            } else if (arg == "--random" && i + 2 < argc) {
+                int m = std::atoi(argv[++i]);
+                if (m < 1) return 1;
+                G = makeRandomGrammar(m, std::strtoul(argv[++i], nullptr, 10));
+            } else if (arg == "--left-corner") {
+                algorithm = GNFAlgorithm::LeftCorner;
+            } else if (arg == "--matrix") {
+                algorithm = GNFAlgorithm::Matrix;
+            } else if (arg == "--threads" && i + 1 < argc) {
+                threads = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--time-limit" && i + 1 < argc) {
+                timeLimit = std::strtod(argv[++i], nullptr);
+            } else {
+                length = std::strtoul(argv[i], nullptr, 10);
+            }
+        }
+
+        GNFConverter converter(G);
+        converter.setVerbose(false);
+        converter.setAlgorithm(algorithm);
+        if (!converter.run()) return 1;
+
+        EquivalenceChecker checker;
+        EquivalenceReport report;
+        if (!checker.build(G, converter.result(), converter.startVariable())) return 1;
+        bool same = checker.check(length, threads, report);
+        std::cout << "length<=" << length << "  strings=" << report.strings << "  accepted=" << report.accepted
+                  << "  dead prefixes=" << report.deadPrefixes << "  mismatches=" << report.mismatches
+                  << "  time=" << report.seconds << "s" << std::endl;
+        for (const std::string& example : report.examples) std::cout << "  " << example << std::endl;
+        if (timeLimit > 0 && report.seconds > timeLimit) {
+            std::cerr << "Error: the check took " << report.seconds << "s, over the limit of " << timeLimit << "s." << std::endl;
+            return 1;
+        }
+        return same ? 0 : 1;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--check-incremental") {
+        int m = 4;
+        unsigned grammarSeed = 1, seed = 1;
+        size_t edits = 200;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--random" && i + 2 < argc) {
+                m = std::atoi(argv[++i]);
+                if (m < 1) return 1;
+                grammarSeed = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--seed" && i + 1 < argc) {
+                seed = std::strtoul(argv[++i], nullptr, 10);
+            } else {
+                edits = std::strtoul(argv[i], nullptr, 10);
+            }
+        }
+        return runIncrementalCheck(makeRandomGrammar(m, grammarSeed), m, seed, edits) ? 1 : 0;
+    }
+
     std::cout << "Greibach Normal Form (GNF) Algorithm Simulation" << std::endl;
     std::cout << "===============================================" << std::endl;
 
@@ -295,12 +3332,12 @@ int main() {
     // A2 -> A3 A1 | b
     // A3 -> A1 A2 | a
     
-    Symbol A1 = {"A1", VARIABLE, 1};
-    Symbol A2 = {"A2", VARIABLE, 2};
-    Symbol A3 = {"A3", VARIABLE, 3};
+    Symbol A1 = symbols().intern("A1", VARIABLE, 1);
+    Symbol A2 = symbols().intern("A2", VARIABLE, 2);
+    Symbol A3 = symbols().intern("A3", VARIABLE, 3);
     
-    Symbol a = {"a", TERMINAL, 0};
-    Symbol b = {"b", TERMINAL, 0};
+    Symbol a = symbols().intern("a", TERMINAL);
+    Symbol b = symbols().intern("b", TERMINAL);
 
     Grammar G;
 
@@ -312,9 +3349,22 @@ int main() {
     G[A3].insert({A1, A2});
     G[A3].insert({a});
 
-    printGrammar(G, "Original Grammar Rules");
+    bool quiet = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quiet") quiet = true;
+        if (arg == "--grammar" && i + 1 < argc) {
+            // Converts a grammar file instead of the test grammar above
+            G.clear();
+            if (!loadGrammar(argv[++i], G)) return 1;
+        }
+    }
+
+    if (!quiet) printGrammar(G, "Original Grammar Rules");
 
     GNFConverter converter(G);
+    converter.setVerbose(!quiet);
+    converter.setStatsStream(stats);
     converter.run();
 
     return 0;